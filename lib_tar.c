@@ -1,5 +1,13 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include "lib_tar.h"
+#include "tar_bloom.h"
+#include "tar_cache.h"
 /**
  * Prints the contents of a TAR header to standard output.
  *
@@ -39,6 +47,112 @@ void print_tar_header(const tar_header_t *header)
     // Padding is not printed as it's usually not relevant for display
 }
 
+/**
+ * Decodes a numeric field of a TAR header.
+ *
+ * Two encodings are supported:
+ *  - ASCII octal, optionally preceded by spaces and terminated by a space or a NUL,
+ *    as written by every POSIX tar;
+ *  - base-256 (the first byte has its high bit set), used by GNU tar and star for
+ *    values that do not fit in octal, e.g. members larger than 8 GiB.
+ *
+ * The field is never read past `width` bytes, so it does not need to be NUL-terminated.
+ *
+ * @param field Pointer to the first byte of the field.
+ * @param width Exact width of the field in bytes (e.g. sizeof(header->size)).
+ *
+ * @return The decoded value. Parsing stops at the first non-octal character, so an
+ *         empty or malformed field decodes to the digits read so far (0 if none).
+ */
+int64_t tar_decode_number(const char *field, size_t width) {
+    const unsigned char *bytes = (const unsigned char *)field;
+    if (width == 0) return 0;
+
+    if (bytes[0] & 0x80) {
+        // Base-256: big-endian two's complement, the marker bit is dropped for positive values
+        uint64_t value = (bytes[0] & 0x40) ? (uint64_t)(int64_t)(int8_t)bytes[0] : (bytes[0] & 0x3f);
+        for (size_t i = 1; i < width; ++i) {
+            value = (value << 8) | bytes[i];
+        }
+        return (int64_t)value;
+    }
+
+    size_t i = 0;
+    while (i < width && bytes[i] == ' ') i++;
+    uint64_t value = 0;
+    for (; i < width; ++i) {
+        unsigned int digit = (unsigned int)bytes[i] - '0';
+        if (digit > 7) break; // NUL, space or garbage ends the number
+        value = (value << 3) | digit;
+    }
+    return (int64_t)value;
+}
+
+/**
+ * Hashes an entry path.
+ *
+ * FNV-1a followed by the murmur3 finalizer, so that every output bit depends on every input byte.
+ *
+ * @param path The path, NUL-terminated or at least MAX_PATH_SIZE bytes long.
+ *
+ * @return A 64-bit hash with well mixed bits.
+ */
+uint64_t tar_hash_path(const char *path) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t len = strnlen(path, MAX_PATH_SIZE);
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)path[i];
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static int io_hints_enabled = 1;
+
+/**
+ * Enables or disables the page-cache hints issued by the library.
+ *
+ * @param enabled zero to stop issuing hints, any other value to issue them (the default).
+ */
+void tar_set_io_hints(int enabled) {
+    __atomic_store_n(&io_hints_enabled, enabled != 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * Passes an access-pattern hint for a range of the archive to the kernel.
+ *
+ * @param tar_fd File descriptor for the TAR archive.
+ * @param offset Start of the range.
+ * @param len Length of the range, zero meaning up to the end of the file.
+ * @param advice One of the POSIX_FADV_* values.
+ *
+ * Note: Hints are best effort, errors (e.g. ESPIPE on a pipe) are ignored.
+ */
+void tar_advise(int tar_fd, off_t offset, off_t len, int advice) {
+    if (__atomic_load_n(&io_hints_enabled, __ATOMIC_RELAXED)) {
+        posix_fadvise(tar_fd, offset, len, advice);
+    }
+}
+
+/**
+ * Checks whether a header block is completely zeroed out, as the end-of-archive blocks are.
+ *
+ * @param header The block to check.
+ *
+ * @return any value other than zero if every byte of the block is zero, zero otherwise.
+ */
+int tar_is_zero_block(const tar_header_t *header) {
+    const unsigned char *bytes = (const unsigned char *)header;
+    unsigned char any = 0;
+    for (size_t i = 0; i < sizeof(tar_header_t); ++i) any |= bytes[i];
+    return any == 0;
+}
+
 /**
  * Reads the next header in a TAR archive and advances past the corresponding file data.
  *
@@ -53,23 +167,27 @@ void print_tar_header(const tar_header_t *header)
  *       should be at the start of a header.
  */
 long next_header(int tar_fd, tar_header_t *header){
-    ssize_t bytesRead = read(tar_fd, header, sizeof(tar_header_t));
+    ssize_t bytesRead;
+    // With a block cache attached, both the header and the position stay in user space
+    off_t position = tar_cache_tell(tar_fd);
+    if (position != -1) {
+        bytesRead = tar_cached_pread(tar_fd, header, sizeof(tar_header_t), position);
+    } else {
+        bytesRead = read(tar_fd, header, sizeof(tar_header_t));
+    }
     if (bytesRead < sizeof(tar_header_t)){
         return -2;
     }
-    long size = TAR_INT(header->size);
-    long skipblock = (size+BLOCKSIZE -1)/ BLOCKSIZE;
-    long err = lseek(tar_fd,skipblock*BLOCKSIZE,SEEK_CUR);
-    // Check if the header is completely zeroed out
-    int isEmpty = 1;
-    for (int i = 0; i < sizeof(tar_header_t); ++i) {
-        if (((unsigned char*)header)[i] != 0) {
-            isEmpty = 0;
-            break;
-        }
+    off_t size = TAR_INT(header->size);
+    if (size < 0) {
+        // A negative base-256 size would move the scan backwards, possibly forever
+        if (position != -1) tar_cache_seek(tar_fd, position + sizeof(tar_header_t));
+        return TAR_HEADER_MALFORMED;
     }
-
-    if (isEmpty) {
+    off_t skipblock = (size+BLOCKSIZE -1)/ BLOCKSIZE;
+    long err = position != -1 ? tar_cache_seek(tar_fd, position + sizeof(tar_header_t) + skipblock*BLOCKSIZE)
+                              : lseek(tar_fd,skipblock*BLOCKSIZE,SEEK_CUR);
+    if (tar_is_zero_block(header)) {
         // If the header is empty, recursively call next_header to check the next one
         return next_header(tar_fd, header);
     }
@@ -82,8 +200,19 @@ long next_header(int tar_fd, tar_header_t *header){
  * @return The offset from the start of the file if successful, or -1 on error.
  */
 long go_back_start(int tar_fd){
+    if (tar_cache_attached(tar_fd) != NULL) {
+        // One fstat per scan keeps the cached chunks in sync with the archive
+        tar_cache_revalidate(tar_fd);
+        return tar_cache_seek(tar_fd, 0);
+    }
     return lseek(tar_fd, 0, SEEK_SET);
 }
+
+/* Position of the next header to read, see next_header */
+static off_t current_position(int tar_fd) {
+    off_t position = tar_cache_tell(tar_fd);
+    return position != -1 ? position : lseek(tar_fd, 0, SEEK_CUR);
+}
 /**
  * Resolves a symbolic link to its target within a TAR archive.
  *
@@ -132,14 +261,14 @@ int resolve_symlink(int tar_fd, const char *symlink_path, char *resolved_path) {
  * @return 0 on success, -1 on failure.
  */
 int seek_to_file_data(int tar_fd, const tar_header_t *header, size_t offset) {
-    long size = TAR_INT(header->size); // Convert size from ASCII to long
-    if (size == 0) {
-        // Invalid size in header or non-numeric characters in size field
+    off_t size = TAR_INT(header->size); // Convert size from its octal/base-256 encoding
+    if (size <= 0) {
+        // Invalid (empty or negative) size in header or non-numeric characters in size field
         return -1;
     }
 
     // Calculate the position of the start of the file data
-    off_t position = lseek(tar_fd, 0, SEEK_CUR);
+    off_t position = current_position(tar_fd);
     if (position == (off_t)-1) {
         // Error in getting current position
         return -1;
@@ -152,8 +281,10 @@ int seek_to_file_data(int tar_fd, const tar_header_t *header, size_t offset) {
     // Adjust with the offset
     new_position += offset;
 
-    // Seek to the calculated position
-    if (lseek(tar_fd, new_position, SEEK_SET) == (off_t)-1) {
+    // Seek to the calculated position, next to the cache if one is attached (see next_header)
+    off_t moved = tar_cache_attached(tar_fd) != NULL ? tar_cache_seek(tar_fd, new_position)
+                                                     : lseek(tar_fd, new_position, SEEK_SET);
+    if (moved == (off_t)-1) {
         // Error in seeking to new position
         return -1;
     }
@@ -212,10 +343,13 @@ unsigned int calculate_tar_checksum(const struct posix_header *header) {
  *         3 symlink.
  */
 int get_header_type(int tar_fd, char *path, tar_header_t *header){
+    // A negative answer from an attached Bloom filter is certain, no need to scan
+    const tar_bloom_t *bloom = tar_bloom_attached(tar_fd);
+    if (bloom != NULL && !tar_bloom_may_contain(bloom, path)) return 0;
     go_back_start(tar_fd);
     while(1){
         long err = next_header(tar_fd, header);
-        if (err == -2){
+        if (err == -2 || err == TAR_HEADER_MALFORMED){
             break;
         } else if (err == -1){
             printf("Error from lseek");
@@ -237,26 +371,13 @@ int get_header_type(int tar_fd, char *path, tar_header_t *header){
     return 0;
 }
 
-/**
- * Checks whether the archive is valid.
- *
- * Each non-null header of a valid archive has:
- *  - a magic value of "ustar" and a null,
- *  - a version value of "00" and no null,
- *  - a correct checksum
- *
- * @param tar_fd A file descriptor pointing to the start of a file supposed to contain a tar archive.
- *
- * @return a zero or positive value if the archive is valid, representing the number of non-null headers in the archive,
- *         -1 if the archive contains a header with an invalid magic value,
- *         -2 if the archive contains a header with an invalid version value,
- *         -3 if the archive contains a header with an invalid checksum value
- */
-int check_archive(int tar_fd) {
+/* Validates every header from the start of the archive, see check_archive */
+static int check_headers(int tar_fd) {
     tar_header_t header;
     go_back_start(tar_fd);
     int headers = 0;
-    while(next_header(tar_fd, &header)>0){
+    long err;
+    while((err = next_header(tar_fd, &header))>0){
         if (strncmp(header.magic,TMAGIC, TMAGLEN)!=0 ){
             return -1;
         }
@@ -273,9 +394,34 @@ int check_archive(int tar_fd) {
         }
         headers++;
     }
+    if (err == TAR_HEADER_MALFORMED) return -4;
     return headers;
 }
 
+/**
+ * Checks whether the archive is valid.
+ *
+ * Each non-null header of a valid archive has:
+ *  - a magic value of "ustar" and a null,
+ *  - a version value of "00" and no null,
+ *  - a correct checksum,
+ *  - a size that is not negative
+ *
+ * @param tar_fd A file descriptor pointing to the start of a file supposed to contain a tar archive.
+ *
+ * @return a zero or positive value if the archive is valid, representing the number of non-null headers in the archive,
+ *         -1 if the archive contains a header with an invalid magic value,
+ *         -2 if the archive contains a header with an invalid version value,
+ *         -3 if the archive contains a header with an invalid checksum value,
+ *         -4 if the archive contains a header with a negative size value
+ */
+int check_archive(int tar_fd) {
+    tar_advise(tar_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    int ret = check_headers(tar_fd);
+    tar_advise(tar_fd, 0, 0, POSIX_FADV_NORMAL);
+    return ret;
+}
+
 /**
  * Checks whether an entry exists in the archive.
  *
@@ -382,16 +528,19 @@ int list(int tar_fd, char *path, char **entries, size_t *no_entries) {
     }
     // We should only come here if the path is to a directory
 
+    tar_advise(tar_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
     go_back_start(tar_fd);
     tar_header_t  header_sub;
+    int ret = 1;
     //for loop that get all the entries of the directory
     while(*no_entries < entries_length){
         long err = next_header(tar_fd, &header_sub);
-        if (err == -2){
+        if (err == -2 || err == TAR_HEADER_MALFORMED){
             break;
         } else if (err == -1){
             printf("Error from lseek");
-            return 0;
+            ret = 0;
+            break;
         }
 
         printf("header_sub name: %s\n", header_sub.name);
@@ -402,18 +551,57 @@ int list(int tar_fd, char *path, char **entries, size_t *no_entries) {
                 entries[*no_entries] = strdup(header_sub.name);
                 if (entries[*no_entries] == NULL){
                     printf("Error of strdup");
-                    return -1;
+                    ret = -1;
+                    break;
                 }
                 (*no_entries)++;
             }
         }
 
     }
+    tar_advise(tar_fd, 0, 0, POSIX_FADV_NORMAL);
 
-    return 1;
+    return ret;
 }
 
 
+/**
+ * Finds the data of a file in the archive, following symlinks and hard links.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to an entry in the archive.
+ * @param data_offset Out argument, set to the offset of the first data byte of the file in the archive.
+ * @param size Out argument, set to the size of the file.
+ *
+ * @return 0 on success, -1 if the path (or the target of a link) does not exist or is not a file.
+ *
+ * Note: Link targets are taken relative to the root of the archive, a leading "./" is
+ *       ignored. At most TAR_MAX_LINKS links are followed.
+ */
+int tar_locate_file(int tar_fd, const char *path, off_t *data_offset, off_t *size) {
+    char current[MAX_PATH_SIZE + 1];
+    strncpy(current, path, MAX_PATH_SIZE);
+    current[MAX_PATH_SIZE] = '\0';
+    for (int links = 0; links <= TAR_MAX_LINKS; ++links) {
+        tar_header_t header;
+        int type = get_header_type(tar_fd, current, &header);
+        if (type == 1) {
+            *size = TAR_INT(header.size);
+            if (*size < 0) return -1; // malformed header, no data to locate
+            // get_header_type leaves the descriptor right after the padded data of the entry
+            *data_offset = current_position(tar_fd) - ((*size + BLOCKSIZE - 1) / BLOCKSIZE) * BLOCKSIZE;
+            return 0;
+        }
+        if (type != 3 && type != 4) return -1;
+        const char *target = header.linkname;
+        while (strncmp(target, "./", 2) == 0) target += 2;
+        size_t target_len = strnlen(target, MAX_PATH_SIZE - (target - header.linkname));
+        memmove(current, target, target_len);
+        current[target_len] = '\0';
+    }
+    return -1;
+}
+
 size_t get_read_length(size_t len_buf, size_t size_file, size_t offset) {
     if (len_buf < size_file - offset) return len_buf;
     return size_file - offset;
@@ -439,35 +627,214 @@ size_t get_read_length(size_t len_buf, size_t size_file, size_t offset) {
  *
  */
 ssize_t read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len) {
-    go_back_start(tar_fd);
-//    printf("Reading header for %s\n",path);
-    tar_header_t header;
-    int type= get_header_type(tar_fd,path,&header);
-//    print_tar_header(&header);
-    if (type == 0 ) { *len = 0;return -1; }
-    if (type == 2) { *len = 0;return -1; }
-    long size = TAR_INT(header.size);
-//    printf("type of file : %d\n ",(int )type);
-    if (type == 3 || type == 4) { // Symlink
-        // Resolve symlink (you need to implement resolve_symlink)
-        char resolved_path[MAX_PATH_SIZE];
-//        printf("\n path :%s \n",resolved_path);
-        if (resolve_symlink(tar_fd, path, resolved_path) == -1) {
-            *len = 0;
-            return -1; // Error resolving symlink
-        }
-        return read_file(tar_fd, resolved_path, offset, dest, len);
-    }
+    off_t data_start, size;
+    if (tar_locate_file(tar_fd, path, &data_start, &size) == -1) { *len = 0;return -1; }
     if (size <= offset) return -2;
     size_t to_read = get_read_length(*len, size, offset);
 //    printf("To read : %d\n", (int)to_read);
-    lseek(tar_fd, get_offset_from_start(tar_fd,path)+512, SEEK_SET);
-    lseek(tar_fd, (off_t) offset, SEEK_CUR);
-    ssize_t bytes_read = read(tar_fd, dest, to_read);
+    ssize_t bytes_read = tar_cached_pread(tar_fd, dest, to_read, data_start + (off_t) offset);
     if (bytes_read == -1) {
         *len = 0;
         return -1;
     }
+    if (to_read >= TAR_DONTNEED_THRESHOLD) {
+        // Large streamed reads are not worth keeping, give the pages back to the hot set
+        tar_advise(tar_fd, data_start + (off_t) offset, (off_t) bytes_read, POSIX_FADV_DONTNEED);
+    }
     *len = bytes_read;
-    return size > bytes_read + offset ? (int)(size - bytes_read - offset) : 0;
-}
\ No newline at end of file
+    return size > bytes_read + offset ? (ssize_t)(size - bytes_read - offset) : 0;
+}
+
+/* A range of read_file_v, clipped to the end of the file */
+struct ordered_range
+{
+    size_t offset;
+    size_t len;
+    size_t index;                 /* position in the caller's arrays */
+};
+
+static int compare_ranges(const void *a, const void *b) {
+    const struct ordered_range *x = a, *y = b;
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+/* Fetches sorted, non-overlapping ranges with preadv, the gaps go to gap_buffer. Returns the bytes fetched or -1 */
+static ssize_t read_group(int tar_fd, off_t data_start, const struct ordered_range *group, size_t count,
+                          struct iovec *iovecs, uint8_t *gap_buffer) {
+    struct iovec parts[IOV_MAX];
+    int nparts = 0;
+    size_t end = group[0].offset;
+    for (size_t i = 0; i < count; ++i) {
+        if (group[i].offset > end) parts[nparts++] = (struct iovec){gap_buffer, group[i].offset - end};
+        parts[nparts++] = (struct iovec){iovecs[group[i].index].iov_base, group[i].len};
+        end = group[i].offset + group[i].len;
+    }
+    size_t total = end - group[0].offset, done = 0;
+    struct iovec *next = parts;
+    while (done < total) {
+        ssize_t n = preadv(tar_fd, next, nparts - (int)(next - parts), data_start + (off_t)(group[0].offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break; // truncated archive, the ranges are shortened
+        done += (size_t)n;
+        // Skip the parts filled by this call and trim the one it stopped in
+        while (n > 0 && (size_t)n >= next->iov_len) {
+            n -= (ssize_t)next->iov_len;
+            next++;
+        }
+        if (n > 0) {
+            next->iov_base = (uint8_t *)next->iov_base + n;
+            next->iov_len -= (size_t)n;
+        }
+    }
+    return (ssize_t)done;
+}
+
+/**
+ * Reads several ranges of a file at a given path in the archive.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to an entry in the archive to read from. If the entry is a symlink, it is resolved.
+ * @param ranges The ranges to read, in any order.
+ * @param n The number of ranges.
+ * @param iovecs An in-out array of n buffers, iov_base is set by the caller and iov_len by the callee.
+ * @param remaining Out array of n values, each set as read_file would return for its range.
+ *
+ * @return -1 if no entry at the given path exists in the archive or the entry is not a file,
+ *         or on read error, the total number of bytes read otherwise.
+ */
+ssize_t read_file_v(int tar_fd, char *path, const struct tar_range *ranges, size_t n, struct iovec *iovecs, ssize_t *remaining) {
+    off_t data_start, size;
+    for (size_t i = 0; i < n; ++i) iovecs[i].iov_len = 0;
+    if (tar_locate_file(tar_fd, path, &data_start, &size) == -1) return -1;
+
+    struct ordered_range *sorted = malloc((n ? n : 1) * sizeof(struct ordered_range));
+    if (sorted == NULL) return -1;
+    size_t count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (ranges[i].offset >= (uint64_t)size) { // unsigned, as in read_file, so huge offsets do not wrap
+            remaining[i] = -2;
+            continue;
+        }
+        sorted[count++] = (struct ordered_range){ranges[i].offset, get_read_length(ranges[i].len, size, ranges[i].offset), i};
+    }
+    qsort(sorted, count, sizeof(struct ordered_range), compare_ranges);
+
+    ssize_t total = 0;
+    uint8_t *gap_buffer = NULL;
+    int cached = tar_cache_attached(tar_fd) != NULL;
+    for (size_t first = 0; first < count;) {
+        // Extend the group while the next range starts after the previous one, close enough
+        size_t last = first + 1, end = sorted[first].offset + sorted[first].len;
+        int nparts = 1;
+        while (!cached && last < count && sorted[last].offset >= end && sorted[last].offset - end <= TAR_COALESCE_GAP
+               && nparts + 2 <= IOV_MAX) {
+            nparts += (sorted[last].offset > end) + 1;
+            end = sorted[last].offset + sorted[last].len;
+            last++;
+        }
+        if ((size_t)nparts > last - first && gap_buffer == NULL) {
+            gap_buffer = malloc(TAR_COALESCE_GAP);
+            if (gap_buffer == NULL) {
+                total = -1;
+                break;
+            }
+        }
+        ssize_t fetched = cached ? tar_cached_pread(tar_fd, iovecs[sorted[first].index].iov_base, sorted[first].len,
+                                                    data_start + (off_t)sorted[first].offset)
+                                 : read_group(tar_fd, data_start, &sorted[first], last - first, iovecs, gap_buffer);
+        if (fetched == -1) {
+            total = -1;
+            break;
+        }
+        for (size_t i = first; i < last; ++i) {
+            size_t skip = sorted[i].offset - sorted[first].offset;
+            size_t got = (size_t)fetched <= skip ? 0 : (size_t)fetched - skip;
+            if (got > sorted[i].len) got = sorted[i].len;
+            iovecs[sorted[i].index].iov_len = got;
+            remaining[sorted[i].index] = (ssize_t)(size - (off_t)(sorted[i].offset + got));
+            total += (ssize_t)got;
+        }
+        first = last;
+    }
+    free(gap_buffer);
+    free(sorted);
+    return total;
+}
+
+/* Moves up to len bytes with the first zero-copy primitive the pair of descriptors supports */
+static ssize_t transfer(int tar_fd, off_t *position, int out_fd, size_t len, int *method) {
+    ssize_t n;
+    for (;;) {
+        switch (*method) {
+            case 0: // in-kernel copy between regular files, may even share extents
+                n = copy_file_range(tar_fd, position, out_fd, NULL, len, 0);
+                break;
+            case 1: // page cache straight to a socket, pipe or file
+                n = sendfile(out_fd, tar_fd, position, len);
+                break;
+            default: {
+                char buffer[64 * 1024];
+                n = pread(tar_fd, buffer, len < sizeof(buffer) ? len : sizeof(buffer), *position);
+                if (n <= 0) return n;
+                ssize_t written = 0;
+                while (written < n) {
+                    ssize_t w = write(out_fd, buffer + written, n - written);
+                    if (w < 0 && errno == EINTR) continue;
+                    if (w < 0) return written > 0 ? written : -1;
+                    written += w;
+                }
+                *position += written;
+                return written;
+            }
+        }
+        if (n >= 0) return n;
+        if (errno == EINTR) continue;
+        // Unsupported by this pair of descriptors: fall back to the next primitive
+        if (errno == EINVAL || errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF) {
+            (*method)++;
+            continue;
+        }
+        return -1;
+    }
+}
+
+/**
+ * Copies a file at a given path in the archive to another file descriptor.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to an entry in the archive to read from. If the entry is a symlink, it is resolved.
+ * @param offset An offset in the file from which to start copying, zero indicates the start of the file.
+ * @param len An in-out argument.
+ *            The caller set it to the maximum number of bytes to copy.
+ *            The callee set it to the number of bytes written to out_fd.
+ * @param out_fd The destination: a socket, a pipe or a regular file (written at its current offset).
+ *
+ * @return -1 if no entry at the given path exists in the archive or the entry is not a file,
+ *         -2 if the offset is outside the file total length,
+ *         -3 if writing to out_fd failed (errno is set, len holds the bytes copied so far),
+ *         zero if the file was copied up to its end,
+ *         a positive value representing the remaining bytes left to be copied to reach the end of the file.
+ */
+ssize_t tar_send_entry(int tar_fd, char *path, size_t offset, size_t *len, int out_fd) {
+    off_t data_start, size;
+    size_t wanted = *len;
+    *len = 0;
+    if (tar_locate_file(tar_fd, path, &data_start, &size) == -1) return -1;
+    if (size <= offset) return -2;
+    size_t to_send = get_read_length(wanted, size, offset);
+
+    struct stat st;
+    int method = fstat(out_fd, &st) == 0 && S_ISREG(st.st_mode) ? 0 : 1;
+    off_t position = data_start + (off_t) offset;
+    while (*len < to_send) {
+        ssize_t n = transfer(tar_fd, &position, out_fd, to_send - *len, &method);
+        if (n < 0) return -3;
+        if (n == 0) break; // the archive is truncated
+        *len += n;
+    }
+    if (to_send >= TAR_DONTNEED_THRESHOLD) {
+        tar_advise(tar_fd, data_start + (off_t) offset, (off_t) *len, POSIX_FADV_DONTNEED);
+    }
+    return (ssize_t)(size - (off_t) offset - (off_t) *len);
+}
@@ -5,7 +5,9 @@
 #include <stdio.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/uio.h>
 
 typedef struct posix_header
 {                              /* byte offset */
@@ -35,6 +37,14 @@ typedef struct posix_header
 
 #define BLOCKSIZE 512
 #define MAX_PATH_SIZE 100
+/* Maximum number of links followed when resolving a path */
+#define TAR_MAX_LINKS 8
+/* Returned by next_header for a header whose size field is negative */
+#define TAR_HEADER_MALFORMED (-3)
+/* Reads at least this large are dropped from the page cache once served */
+#define TAR_DONTNEED_THRESHOLD (8 * 1024 * 1024)
+/* Ranges of read_file_v separated by at most this many bytes are fetched by the same preadv */
+#define TAR_COALESCE_GAP (16 * 1024)
 /* Values used in typeflag field.  */
 #define REGTYPE  '0'            /* regular file */
 #define AREGTYPE '\0'           /* regular file */
@@ -42,8 +52,27 @@ typedef struct posix_header
 #define SYMTYPE  '2'            /* reserved */
 #define DIRTYPE  '5'            /* directory */
 
-/* Converts an ASCII-encoded octal-based number into a regular integer */
-#define TAR_INT(char_ptr) strtol(char_ptr, NULL, 8)
+/* Converts a numeric header field (octal or base-256) into a regular integer */
+#define TAR_INT(field) tar_decode_number((field), sizeof(field))
+
+/**
+ * Decodes a numeric field of a TAR header.
+ *
+ * Two encodings are supported:
+ *  - ASCII octal, optionally preceded by spaces and terminated by a space or a NUL,
+ *    as written by every POSIX tar;
+ *  - base-256 (the first byte has its high bit set), used by GNU tar and star for
+ *    values that do not fit in octal, e.g. members larger than 8 GiB.
+ *
+ * The field is never read past `width` bytes, so it does not need to be NUL-terminated.
+ *
+ * @param field Pointer to the first byte of the field.
+ * @param width Exact width of the field in bytes (e.g. sizeof(header->size)).
+ *
+ * @return The decoded value. Parsing stops at the first non-octal character, so an
+ *         empty or malformed field decodes to the digits read so far (0 if none).
+ */
+int64_t tar_decode_number(const char *field, size_t width);
 
 /**
  * Prints the contents of a TAR header to standard output.
@@ -60,6 +89,53 @@ typedef struct posix_header
  */
 void print_tar_header(const tar_header_t *header);
 
+/**
+ * Hashes an entry path.
+ *
+ * Only the first MAX_PATH_SIZE bytes are significant, as for the name field of a
+ * header, so a path and the header name it matches always hash the same.
+ *
+ * @param path The path, NUL-terminated or at least MAX_PATH_SIZE bytes long.
+ *
+ * @return A 64-bit hash with well mixed bits.
+ */
+uint64_t tar_hash_path(const char *path);
+
+/**
+ * Enables or disables the page-cache hints issued by the library.
+ *
+ * By default the library tells the kernel how it accesses the archive:
+ *  - POSIX_FADV_SEQUENTIAL for the duration of a full scan of the archive (check_archive, list,
+ *    the index and filter builders, tar_search, tar_digest), POSIX_FADV_NORMAL once it is over,
+ *  - POSIX_FADV_DONTNEED on the data range read by read_file or tar_send_entry when it is at
+ *    least TAR_DONTNEED_THRESHOLD bytes.
+ *
+ * @param enabled zero to stop issuing hints, any other value to issue them (the default).
+ */
+void tar_set_io_hints(int enabled);
+
+/**
+ * Passes an access-pattern hint for a range of the archive to the kernel.
+ *
+ * @param tar_fd File descriptor for the TAR archive.
+ * @param offset Start of the range.
+ * @param len Length of the range, zero meaning up to the end of the file.
+ * @param advice One of the POSIX_FADV_* values.
+ *
+ * Note: Does nothing when hints are disabled with tar_set_io_hints. Hints are best
+ *       effort, errors (e.g. ESPIPE on a pipe) are ignored.
+ */
+void tar_advise(int tar_fd, off_t offset, off_t len, int advice);
+
+/**
+ * Checks whether a header block is completely zeroed out, as the end-of-archive blocks are.
+ *
+ * @param header The block to check.
+ *
+ * @return any value other than zero if every byte of the block is zero, zero otherwise.
+ */
+int tar_is_zero_block(const tar_header_t *header);
+
 /**
  * Reads the next header in a TAR archive and advances past the corresponding file data.
  *
@@ -68,10 +144,13 @@ void print_tar_header(const tar_header_t *header);
  *
  * @return Returns the position in the archive after the current file's data. Returns -2
  *         if a complete header cannot be read, indicating the end of the archive or an
- *         error. Returns -1 on seek errors.
+ *         error. Returns -1 on seek errors. Returns TAR_HEADER_MALFORMED if the size field
+ *         of the header is negative, the descriptor is then left right after the header.
  *
  * Note: Assumes proper definition of tar_header_t and BLOCKSIZE. The file descriptor
- *       should be at the start of a header.
+ *       should be at the start of a header. If a block cache is attached to tar_fd
+ *       (see tar_cache_attach), the header is read through it and the position is
+ *       tracked by tar_cache_tell/tar_cache_seek instead of the file offset.
  */
 long next_header(int tar_fd, tar_header_t *header);
 /**
@@ -79,6 +158,9 @@ long next_header(int tar_fd, tar_header_t *header);
  *
  * @param tar_fd File descriptor for the TAR archive.
  * @return The offset from the start of the file if successful, or -1 on error.
+ *
+ * Note: With a block cache attached, rewinds the tracked position instead of the file
+ *       offset and first drops the cached chunks if the archive changed (tar_cache_revalidate).
  */
 long go_back_start(int tar_fd);
 /**
@@ -141,6 +223,9 @@ unsigned int calculate_tar_checksum(const struct posix_header *header);
  *         1 file,
  *         2 directory,
  *         3 symlink.
+ *
+ * Note: If a Bloom filter is attached to tar_fd (see tar_bloom_attach), paths it
+ *       rejects are reported missing without reading the archive.
  */
 int get_header_type(int tar_fd, char *path, tar_header_t *header);
 
@@ -151,14 +236,16 @@ int get_header_type(int tar_fd, char *path, tar_header_t *header);
  * Each non-null header of a valid archive has:
  *  - a magic value of "ustar" and a null,
  *  - a version value of "00" and no null,
- *  - a correct checksum
+ *  - a correct checksum,
+ *  - a size that is not negative
  *
  * @param tar_fd A file descriptor pointing to the start of a file supposed to contain a tar archive.
  *
  * @return a zero or positive value if the archive is valid, representing the number of non-null headers in the archive,
  *         -1 if the archive contains a header with an invalid magic value,
  *         -2 if the archive contains a header with an invalid version value,
- *         -3 if the archive contains a header with an invalid checksum value
+ *         -3 if the archive contains a header with an invalid checksum value,
+ *         -4 if the archive contains a header with a negative size value
  */
 int check_archive(int tar_fd);
 
@@ -248,7 +335,79 @@ int list(int tar_fd, char *path, char **entries, size_t *no_entries);
  *         a positive value if the file was partially read, representing the remaining bytes left to be read to reach
  *         the end of the file.
  *
+ * Note: Small reads are served through the block cache attached to tar_fd, if any.
  */
 ssize_t read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len);
 
+/* A byte range of a file, for read_file_v */
+struct tar_range
+{
+    size_t offset;                /* from the start of the file */
+    size_t len;                   /* number of bytes wanted */
+};
+
+/**
+ * Reads several ranges of a file at a given path in the archive.
+ *
+ * The entry is looked up once. The ranges are then sorted by offset and neighbours
+ * (overlapping ranges excepted) are fetched together with a single preadv, the gaps
+ * between them being read into a scratch buffer when they are shorter than TAR_COALESCE_GAP.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to an entry in the archive to read from. If the entry is a symlink, it is resolved.
+ * @param ranges The ranges to read, in any order.
+ * @param n The number of ranges.
+ * @param iovecs An in-out array of n buffers.
+ *               The caller set iov_base to a buffer of at least ranges[i].len bytes.
+ *               The callee set iov_len to the number of bytes written to it.
+ * @param remaining Out array of n values, each set as read_file would return for its range:
+ *                  -2 if the offset is outside the file total length,
+ *                  zero if the range reached the end of the file,
+ *                  a positive value representing the bytes left after the range otherwise.
+ *
+ * @return -1 if no entry at the given path exists in the archive or the entry is not a file,
+ *         or on read error, the total number of bytes read otherwise.
+ *
+ * Note: When a block cache is attached to tar_fd, the ranges are read through it instead.
+ */
+ssize_t read_file_v(int tar_fd, char *path, const struct tar_range *ranges, size_t n, struct iovec *iovecs, ssize_t *remaining);
+
+/**
+ * Finds the data of a file in the archive, following symlinks and hard links.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to an entry in the archive.
+ * @param data_offset Out argument, set to the offset of the first data byte of the file in the archive.
+ * @param size Out argument, set to the size of the file.
+ *
+ * @return 0 on success, -1 if the path (or the target of a link) does not exist or is not a file.
+ *
+ * Note: Link targets are taken relative to the root of the archive, a leading "./" is
+ *       ignored. At most TAR_MAX_LINKS links are followed.
+ */
+int tar_locate_file(int tar_fd, const char *path, off_t *data_offset, off_t *size);
+
+/**
+ * Copies a file at a given path in the archive to another file descriptor.
+ *
+ * The data does not go through a user-space buffer when the kernel can avoid it:
+ * copy_file_range is used towards regular files and sendfile towards sockets and
+ * pipes, with a buffered pread/write loop only as a last resort.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to an entry in the archive to read from. If the entry is a symlink, it is resolved.
+ * @param offset An offset in the file from which to start copying, zero indicates the start of the file.
+ * @param len An in-out argument.
+ *            The caller set it to the maximum number of bytes to copy.
+ *            The callee set it to the number of bytes written to out_fd.
+ * @param out_fd The destination: a socket, a pipe or a regular file (written at its current offset).
+ *
+ * @return -1 if no entry at the given path exists in the archive or the entry is not a file,
+ *         -2 if the offset is outside the file total length,
+ *         -3 if writing to out_fd failed (errno is set, len holds the bytes copied so far),
+ *         zero if the file was copied up to its end,
+ *         a positive value representing the remaining bytes left to be copied to reach the end of the file.
+ */
+ssize_t tar_send_entry(int tar_fd, char *path, size_t offset, size_t *len, int out_fd);
+
 #endif
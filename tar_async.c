@@ -0,0 +1,329 @@
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include "tar_async.h"
+
+struct tar_async
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    tar_async_op_t *queue_head;   /* submitted operations, oldest first */
+    tar_async_op_t *queue_tail;
+    tar_async_op_t *done_head;    /* completed operations waiting for tar_async_reap */
+    tar_async_op_t *done_tail;
+    size_t pending;               /* queued and running operations */
+    size_t max_pending;
+    int event_fd;
+    int stopping;
+    unsigned int nthreads;
+    pthread_t *threads;
+    pthread_mutex_t fd_locks[TAR_ASYNC_FD_STRIPES];
+};
+
+/* Hands a finished operation to its callback or to the reap queue. Called with the lock held, returns with it released */
+static void complete(tar_async_t *pool, tar_async_op_t *op, int state) {
+    op->state = state;
+    if (op->callback == NULL) {
+        op->next = NULL;
+        if (pool->done_tail != NULL) pool->done_tail->next = op;
+        else pool->done_head = op;
+        pool->done_tail = op;
+        uint64_t one = 1;
+        ssize_t written = write(pool->event_fd, &one, sizeof(one));
+        (void)written; // only fails when the counter is saturated, it is readable then anyway
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    op->callback(op, op->arg);
+}
+
+static void run(tar_async_op_t *op) {
+    switch (op->kind) {
+        case TAR_ASYNC_READ:
+            op->result = read_file(op->tar_fd, op->path, op->offset, op->dest, &op->len);
+            break;
+        case TAR_ASYNC_LIST:
+            op->result = list(op->tar_fd, op->path, op->entries, &op->no_entries);
+            break;
+        default:
+            op->result = get_header_type(op->tar_fd, op->path, &op->header);
+            break;
+    }
+}
+
+static void *worker(void *arg) {
+    tar_async_t *pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->queue_head == NULL && !pool->stopping) pthread_cond_wait(&pool->work, &pool->lock);
+        if (pool->stopping) break;
+        tar_async_op_t *op = pool->queue_head;
+        pool->queue_head = op->next;
+        if (pool->queue_head == NULL) pool->queue_tail = NULL;
+        op->state = TAR_ASYNC_RUNNING;
+        pthread_mutex_unlock(&pool->lock);
+
+        pthread_mutex_t *fd_lock = &pool->fd_locks[(unsigned int)op->tar_fd % TAR_ASYNC_FD_STRIPES];
+        pthread_mutex_lock(fd_lock);
+        run(op);
+        pthread_mutex_unlock(fd_lock);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->pending--;
+        complete(pool, op, TAR_ASYNC_DONE);
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/**
+ * Starts a pool of threads running archive operations in the background.
+ *
+ * @param nthreads Number of threads, 0 uses one per online CPU.
+ * @param max_pending Maximum number of queued and running operations, submissions beyond it fail.
+ *
+ * @return The pool, or NULL on error.
+ */
+tar_async_t *tar_async_new(unsigned int nthreads, size_t max_pending) {
+    if (max_pending == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (nthreads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = cpus > 0 ? (unsigned int)cpus : 1;
+    }
+    tar_async_t *pool = calloc(1, sizeof(tar_async_t));
+    if (pool == NULL) return NULL;
+    pool->max_pending = max_pending;
+    pool->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pool->threads = malloc(nthreads * sizeof(pthread_t));
+    if (pool->event_fd == -1 || pool->threads == NULL) {
+        if (pool->event_fd != -1) close(pool->event_fd);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    for (int i = 0; i < TAR_ASYNC_FD_STRIPES; ++i) pthread_mutex_init(&pool->fd_locks[i], NULL);
+    for (; pool->nthreads < nthreads; ++pool->nthreads) {
+        if (pthread_create(&pool->threads[pool->nthreads], NULL, worker, pool) != 0) break;
+    }
+    if (pool->nthreads == 0) {
+        tar_async_free(pool);
+        errno = EAGAIN;
+        return NULL;
+    }
+    return pool;
+}
+
+/**
+ * Stops a pool. Queued operations are cancelled and completed, running ones are waited for,
+ * and completions that were not reaped are released.
+ *
+ * @param pool The pool, may be NULL.
+ */
+void tar_async_free(tar_async_t *pool) {
+    if (pool == NULL) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (unsigned int i = 0; i < pool->nthreads; ++i) pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->queue_head != NULL) {
+        tar_async_op_t *op = pool->queue_head;
+        pool->queue_head = op->next;
+        pool->pending--;
+        op->result = -1;
+        complete(pool, op, TAR_ASYNC_CANCELLED);
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    tar_async_op_t *op;
+    while ((op = tar_async_reap(pool)) != NULL) tar_async_release(op);
+
+    for (int i = 0; i < TAR_ASYNC_FD_STRIPES; ++i) pthread_mutex_destroy(&pool->fd_locks[i]);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    close(pool->event_fd);
+    free(pool->threads);
+    free(pool);
+}
+
+/**
+ * Returns the eventfd signalled when operations submitted without callback complete.
+ *
+ * @param pool The pool.
+ *
+ * @return A non-blocking descriptor to watch for readability, owned by the pool.
+ */
+int tar_async_eventfd(const tar_async_t *pool) {
+    return pool->event_fd;
+}
+
+/**
+ * Takes a completed operation submitted without callback.
+ *
+ * @param pool The pool.
+ *
+ * @return The oldest completed operation, to be released by the caller, or NULL if there is none.
+ */
+tar_async_op_t *tar_async_reap(tar_async_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    tar_async_op_t *op = pool->done_head;
+    if (op != NULL) {
+        pool->done_head = op->next;
+        if (pool->done_head == NULL) pool->done_tail = NULL;
+    } else {
+        // Completions are queued under the lock too, so none can be missed by this reset
+        uint64_t count;
+        ssize_t n = read(pool->event_fd, &count, sizeof(count));
+        (void)n;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return op;
+}
+
+static tar_async_op_t *submit(tar_async_t *pool, tar_async_op_t *op) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->stopping || pool->pending >= pool->max_pending) {
+        // Backpressure: the caller retries once completions came in
+        pthread_mutex_unlock(&pool->lock);
+        free(op);
+        errno = EAGAIN;
+        return NULL;
+    }
+    pool->pending++;
+    op->state = TAR_ASYNC_QUEUED;
+    op->next = NULL;
+    if (pool->queue_tail != NULL) pool->queue_tail->next = op;
+    else pool->queue_head = op;
+    pool->queue_tail = op;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    return op;
+}
+
+static tar_async_op_t *new_op(int kind, int tar_fd, const char *path, tar_async_cb callback, void *arg) {
+    if (strlen(path) > MAX_PATH_SIZE) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    tar_async_op_t *op = calloc(1, sizeof(tar_async_op_t));
+    if (op == NULL) return NULL;
+    op->kind = kind;
+    op->tar_fd = tar_fd;
+    strcpy(op->path, path);
+    op->callback = callback;
+    op->arg = arg;
+    return op;
+}
+
+/**
+ * Submits a read_file.
+ *
+ * @param pool The pool.
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to an entry in the archive, copied.
+ * @param offset An offset in the file from which to start reading from.
+ * @param dest A destination buffer, it must stay valid until completion.
+ * @param len The size of dest.
+ * @param callback Called on completion, NULL to complete through the eventfd.
+ * @param arg Passed to callback.
+ *
+ * @return The operation, or NULL if the pool is full (errno is EAGAIN) or on error.
+ */
+tar_async_op_t *tar_async_read(tar_async_t *pool, int tar_fd, const char *path, size_t offset, uint8_t *dest, size_t len,
+                               tar_async_cb callback, void *arg) {
+    tar_async_op_t *op = new_op(TAR_ASYNC_READ, tar_fd, path, callback, arg);
+    if (op == NULL) return NULL;
+    op->offset = offset;
+    op->dest = dest;
+    op->len = len;
+    return submit(pool, op);
+}
+
+/**
+ * Submits a list.
+ *
+ * @param pool The pool.
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to a directory in the archive, copied.
+ * @param entries An array of char arrays, it must stay valid until completion.
+ * @param no_entries The number of entries in `entries`.
+ * @param callback Called on completion, NULL to complete through the eventfd.
+ * @param arg Passed to callback.
+ *
+ * @return The operation, or NULL if the pool is full (errno is EAGAIN) or on error.
+ */
+tar_async_op_t *tar_async_list(tar_async_t *pool, int tar_fd, const char *path, char **entries, size_t no_entries,
+                               tar_async_cb callback, void *arg) {
+    tar_async_op_t *op = new_op(TAR_ASYNC_LIST, tar_fd, path, callback, arg);
+    if (op == NULL) return NULL;
+    op->entries = entries;
+    op->no_entries = no_entries;
+    return submit(pool, op);
+}
+
+/**
+ * Submits a get_header_type, the header of the entry is returned in the operation.
+ *
+ * @param pool The pool.
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to an entry in the archive, copied.
+ * @param callback Called on completion, NULL to complete through the eventfd.
+ * @param arg Passed to callback.
+ *
+ * @return The operation, or NULL if the pool is full (errno is EAGAIN) or on error.
+ */
+tar_async_op_t *tar_async_stat(tar_async_t *pool, int tar_fd, const char *path, tar_async_cb callback, void *arg) {
+    tar_async_op_t *op = new_op(TAR_ASYNC_STAT, tar_fd, path, callback, arg);
+    if (op == NULL) return NULL;
+    return submit(pool, op);
+}
+
+/**
+ * Cancels an operation that has not started yet.
+ *
+ * @param pool The pool.
+ * @param op The operation.
+ *
+ * @return 0 if the operation was cancelled, -1 if it already started (errno is EBUSY).
+ *
+ * Note: Cancelling an operation that was already released is undefined, its memory may
+ *       belong to a later submission by then.
+ */
+int tar_async_cancel(tar_async_t *pool, tar_async_op_t *op) {
+    pthread_mutex_lock(&pool->lock);
+    tar_async_op_t **link = &pool->queue_head, *previous = NULL;
+    while (*link != NULL && *link != op) {
+        previous = *link;
+        link = &(*link)->next;
+    }
+    if (*link == NULL) {
+        pthread_mutex_unlock(&pool->lock);
+        errno = EBUSY;
+        return -1;
+    }
+    *link = op->next;
+    if (pool->queue_tail == op) pool->queue_tail = previous;
+    pool->pending--;
+    op->result = -1;
+    complete(pool, op, TAR_ASYNC_CANCELLED);
+    return 0;
+}
+
+/**
+ * Releases a completed operation.
+ *
+ * @param op The operation, may be NULL.
+ */
+void tar_async_release(tar_async_op_t *op) {
+    free(op);
+}
@@ -0,0 +1,164 @@
+#ifndef TAR_ASYNC_H
+#define TAR_ASYNC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "lib_tar.h"
+
+/* Kinds of operation */
+#define TAR_ASYNC_READ 1          /* read_file */
+#define TAR_ASYNC_LIST 2          /* list */
+#define TAR_ASYNC_STAT 3          /* get_header_type */
+
+/* States of an operation */
+#define TAR_ASYNC_QUEUED    0
+#define TAR_ASYNC_RUNNING   1
+#define TAR_ASYNC_DONE      2
+#define TAR_ASYNC_CANCELLED 3     /* cancelled before it started, result is -1 */
+
+/* Operations on descriptors mapping to the same stripe are serialized */
+#define TAR_ASYNC_FD_STRIPES 64
+
+struct tar_async_op;
+
+/**
+ * Completion callback, called from a pool thread (or from the thread cancelling the operation).
+ *
+ * @param op The completed operation, the callback may release it.
+ * @param arg The argument given at submission.
+ */
+typedef void (*tar_async_cb)(struct tar_async_op *op, void *arg);
+
+typedef struct tar_async_op
+{
+    int kind;                     /* TAR_ASYNC_READ, TAR_ASYNC_LIST or TAR_ASYNC_STAT */
+    int state;                    /* TAR_ASYNC_* state, read it only once the operation completed */
+    int tar_fd;
+    char path[MAX_PATH_SIZE + 1];
+    size_t offset;                /* read: offset in the file */
+    uint8_t *dest;                /* read: destination buffer */
+    size_t len;                   /* read: size of dest, then the number of bytes read */
+    char **entries;               /* list: destination of the entry names */
+    size_t no_entries;            /* list: capacity of entries, then the number of entries listed */
+    tar_header_t header;          /* stat: header of the entry */
+    ssize_t result;               /* value returned by read_file, list or get_header_type */
+    tar_async_cb callback;        /* NULL to complete through the eventfd */
+    void *arg;
+    struct tar_async_op *next;    /* queue link */
+} tar_async_op_t;
+
+typedef struct tar_async tar_async_t;
+
+/**
+ * Starts a pool of threads running archive operations in the background.
+ *
+ * Operations complete either through their callback, or, when submitted without one,
+ * by being queued for tar_async_reap and signalled on the pool's eventfd.
+ *
+ * @param nthreads Number of threads, 0 uses one per online CPU.
+ * @param max_pending Maximum number of queued and running operations, submissions beyond it fail.
+ *
+ * @return The pool, or NULL on error.
+ *
+ * Note: read_file, list and get_header_type move the file offset of their descriptor, so the
+ *       operations on one descriptor run one at a time. Open an archive several times to
+ *       read it in parallel.
+ */
+tar_async_t *tar_async_new(unsigned int nthreads, size_t max_pending);
+
+/**
+ * Stops a pool. Queued operations are cancelled and completed, running ones are waited for,
+ * and completions that were not reaped are released.
+ *
+ * @param pool The pool, may be NULL.
+ */
+void tar_async_free(tar_async_t *pool);
+
+/**
+ * Returns the eventfd signalled when operations submitted without callback complete.
+ *
+ * @param pool The pool.
+ *
+ * @return A non-blocking descriptor to watch for readability, owned by the pool.
+ */
+int tar_async_eventfd(const tar_async_t *pool);
+
+/**
+ * Takes a completed operation submitted without callback.
+ *
+ * @param pool The pool.
+ *
+ * @return The oldest completed operation, to be released by the caller, or NULL if there is
+ *         none. The eventfd is reset when NULL is returned, call it until then.
+ */
+tar_async_op_t *tar_async_reap(tar_async_t *pool);
+
+/**
+ * Submits a read_file.
+ *
+ * @param pool The pool.
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to an entry in the archive, copied.
+ * @param offset An offset in the file from which to start reading from.
+ * @param dest A destination buffer, it must stay valid until completion.
+ * @param len The size of dest.
+ * @param callback Called on completion, NULL to complete through the eventfd.
+ * @param arg Passed to callback.
+ *
+ * @return The operation, or NULL if the pool is full (errno is EAGAIN) or on error.
+ */
+tar_async_op_t *tar_async_read(tar_async_t *pool, int tar_fd, const char *path, size_t offset, uint8_t *dest, size_t len,
+                               tar_async_cb callback, void *arg);
+
+/**
+ * Submits a list.
+ *
+ * @param pool The pool.
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to a directory in the archive, copied.
+ * @param entries An array of char arrays, it must stay valid until completion.
+ * @param no_entries The number of entries in `entries`.
+ * @param callback Called on completion, NULL to complete through the eventfd.
+ * @param arg Passed to callback.
+ *
+ * @return The operation, or NULL if the pool is full (errno is EAGAIN) or on error.
+ */
+tar_async_op_t *tar_async_list(tar_async_t *pool, int tar_fd, const char *path, char **entries, size_t no_entries,
+                               tar_async_cb callback, void *arg);
+
+/**
+ * Submits a get_header_type, the header of the entry is returned in the operation.
+ *
+ * @param pool The pool.
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to an entry in the archive, copied.
+ * @param callback Called on completion, NULL to complete through the eventfd.
+ * @param arg Passed to callback.
+ *
+ * @return The operation, or NULL if the pool is full (errno is EAGAIN) or on error.
+ */
+tar_async_op_t *tar_async_stat(tar_async_t *pool, int tar_fd, const char *path, tar_async_cb callback, void *arg);
+
+/**
+ * Cancels an operation that has not started yet. It then completes with the
+ * TAR_ASYNC_CANCELLED state, through its callback or the eventfd, like any other.
+ *
+ * @param pool The pool.
+ * @param op The operation.
+ *
+ * @return 0 if the operation was cancelled, -1 if it already started (errno is EBUSY).
+ *
+ * Note: Cancelling an operation that was already released is undefined, its memory may
+ *       belong to a later submission by then.
+ */
+int tar_async_cancel(tar_async_t *pool, tar_async_op_t *op);
+
+/**
+ * Releases a completed operation.
+ *
+ * @param op The operation, may be NULL.
+ */
+void tar_async_release(tar_async_op_t *op);
+
+#endif
@@ -0,0 +1,228 @@
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "lib_tar.h"
+#include "tar_bloom.h"
+#include "tar_sidecar.h"
+
+#define TAR_BLOOM_MAGIC "TARBLOOM"
+#define TAR_BLOOM_VERSION 1
+
+/* A saved filter is a sidecar header (param: nhashes, count: nblocks) followed by the bit array */
+
+static tar_bloom_t *attached[TAR_BLOOM_MAX_FD];
+
+/* The low bits select the block, the high bits give the positions inside it (double hashing) */
+static uint64_t *block_of(const tar_bloom_t *bloom, uint64_t h) {
+    return bloom->bits + (h % bloom->nblocks) * TAR_BLOOM_BLOCK_WORDS;
+}
+
+static void add_hash(tar_bloom_t *bloom, uint64_t h) {
+    uint64_t *block = block_of(bloom, h);
+    uint32_t a = (uint32_t)(h >> 32), b = (uint32_t)(h >> 41) | 1;
+    for (uint32_t i = 0; i < bloom->nhashes; ++i) {
+        uint32_t bit = (a + i * b) % TAR_BLOOM_BLOCK_BITS;
+        block[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+static int test_hash(const tar_bloom_t *bloom, uint64_t h) {
+    const uint64_t *block = block_of(bloom, h);
+    uint32_t a = (uint32_t)(h >> 32), b = (uint32_t)(h >> 41) | 1;
+    uint64_t missing = 0;
+    for (uint32_t i = 0; i < bloom->nhashes; ++i) {
+        uint32_t bit = (a + i * b) % TAR_BLOOM_BLOCK_BITS;
+        missing |= ~block[bit / 64] & (1ULL << (bit % 64));
+    }
+    return missing == 0;
+}
+
+static tar_bloom_t *alloc_filter(uint64_t nblocks, uint32_t nhashes) {
+    tar_bloom_t *bloom = calloc(1, sizeof(tar_bloom_t));
+    if (bloom == NULL) return NULL;
+    size_t bytes = nblocks * TAR_BLOOM_BLOCK_WORDS * sizeof(uint64_t);
+    bloom->bits = aligned_alloc(64, bytes);
+    if (bloom->bits == NULL) {
+        free(bloom);
+        return NULL;
+    }
+    memset(bloom->bits, 0, bytes);
+    bloom->nblocks = nblocks;
+    bloom->nhashes = nhashes;
+    return bloom;
+}
+
+/**
+ * Allocates an empty Bloom filter.
+ *
+ * @param expected Number of paths that will be added.
+ * @param fp_rate Target false-positive rate, strictly between 0 and 1 (e.g. 0.01).
+ *
+ * @return The new filter, or NULL if the arguments are invalid or memory runs out.
+ */
+tar_bloom_t *tar_bloom_new(size_t expected, double fp_rate) {
+    if (!(fp_rate > 0.0 && fp_rate < 1.0)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (expected == 0) expected = 1;
+    // Optimal sizing: m = -n ln(p) / ln(2)^2 bits and k = m/n ln(2) hashes
+    double bits = -(double)expected * log(fp_rate) / (M_LN2 * M_LN2);
+    uint64_t nblocks = (uint64_t)ceil(bits / TAR_BLOOM_BLOCK_BITS);
+    if (nblocks == 0) nblocks = 1;
+    double k = round(bits / (double)expected * M_LN2);
+    uint32_t nhashes = k < 1 ? 1 : (k > 16 ? 16 : (uint32_t)k);
+    return alloc_filter(nblocks, nhashes);
+}
+
+/**
+ * Releases a filter returned by tar_bloom_new, tar_bloom_build or tar_bloom_load.
+ *
+ * @param bloom The filter, may be NULL.
+ */
+void tar_bloom_free(tar_bloom_t *bloom) {
+    if (bloom == NULL) return;
+    free(bloom->bits);
+    free(bloom);
+}
+
+/**
+ * Adds a path to the filter.
+ *
+ * @param bloom The filter.
+ * @param path The path of an archive entry.
+ */
+void tar_bloom_add(tar_bloom_t *bloom, const char *path) {
+    add_hash(bloom, tar_hash_path(path));
+}
+
+/**
+ * Tests whether a path may be in the filter.
+ *
+ * @param bloom The filter.
+ * @param path The path to look for.
+ *
+ * @return zero if the path is certainly not in the filter,
+ *         any other value if it may be.
+ */
+int tar_bloom_may_contain(const tar_bloom_t *bloom, const char *path) {
+    return test_hash(bloom, tar_hash_path(path));
+}
+
+/**
+ * Builds a filter holding the name of every entry of an archive.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param fp_rate Target false-positive rate, strictly between 0 and 1.
+ *
+ * @return The new filter, or NULL on error.
+ */
+tar_bloom_t *tar_bloom_build(int tar_fd, double fp_rate) {
+    struct stat st;
+    if (fstat(tar_fd, &st) == -1) return NULL;
+
+    // Hash every name once, the filter can only be sized when the count is known
+    size_t count = 0, capacity = 64;
+    uint64_t *hashes = malloc(capacity * sizeof(uint64_t));
+    if (hashes == NULL) return NULL;
+    tar_header_t header;
+    tar_advise(tar_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    go_back_start(tar_fd);
+    while (next_header(tar_fd, &header) > 0) {
+        if (count == capacity) {
+            uint64_t *grown = realloc(hashes, 2 * capacity * sizeof(uint64_t));
+            if (grown == NULL) {
+                tar_advise(tar_fd, 0, 0, POSIX_FADV_NORMAL);
+                free(hashes);
+                return NULL;
+            }
+            hashes = grown;
+            capacity *= 2;
+        }
+        hashes[count++] = tar_hash_path(header.name);
+    }
+    tar_advise(tar_fd, 0, 0, POSIX_FADV_NORMAL);
+
+    tar_bloom_t *bloom = tar_bloom_new(count, fp_rate);
+    if (bloom != NULL) {
+        for (size_t i = 0; i < count; ++i) add_hash(bloom, hashes[i]);
+        bloom->archive_size = st.st_size;
+        bloom->archive_mtime = st.st_mtime;
+    }
+    free(hashes);
+    return bloom;
+}
+
+/**
+ * Writes a filter to a sidecar file so it can be reused without rescanning the archive.
+ *
+ * @param bloom The filter.
+ * @param out_fd A file descriptor opened for writing.
+ *
+ * @return 0 on success, -1 on write error.
+ */
+int tar_bloom_save(const tar_bloom_t *bloom, int out_fd) {
+    if (tar_sidecar_write(out_fd, TAR_BLOOM_MAGIC, TAR_BLOOM_VERSION, bloom->nhashes, bloom->nblocks,
+                          bloom->archive_size, bloom->archive_mtime) == -1) return -1;
+    return tar_write_all(out_fd, bloom->bits, bloom->nblocks * TAR_BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+}
+
+/**
+ * Reads a filter written by tar_bloom_save.
+ *
+ * @param in_fd A file descriptor opened for reading, positioned at the saved filter.
+ * @param tar_fd The archive the filter is meant for, or -1 to skip the check.
+ *
+ * @return The filter, or NULL if it cannot be read, if its header is invalid (EINVAL: no blocks,
+ *         a block count that does not fit in memory or that is larger than the sidecar) or if it
+ *         was built from a different version of the archive (ESTALE: size or modification time changed).
+ */
+tar_bloom_t *tar_bloom_load(int in_fd, int tar_fd) {
+    tar_sidecar_header_t file;
+    size_t block_size = TAR_BLOOM_BLOCK_WORDS * sizeof(uint64_t);
+    if (tar_sidecar_read(in_fd, TAR_BLOOM_MAGIC, TAR_BLOOM_VERSION, block_size, tar_fd, &file) == -1) return NULL;
+    if (file.count == 0 || file.param == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    tar_bloom_t *bloom = alloc_filter(file.count, file.param);
+    if (bloom == NULL) return NULL;
+    bloom->archive_size = file.archive_size;
+    bloom->archive_mtime = file.archive_mtime;
+    if (tar_read_all(in_fd, bloom->bits, file.count * block_size) == -1) {
+        tar_bloom_free(bloom);
+        return NULL;
+    }
+    return bloom;
+}
+
+/**
+ * Attaches a filter to an archive file descriptor.
+ *
+ * @param tar_fd The archive file descriptor, below TAR_BLOOM_MAX_FD.
+ * @param bloom The filter, it stays owned by the caller. NULL detaches.
+ *
+ * @return 0 on success, -1 if tar_fd is out of range.
+ */
+int tar_bloom_attach(int tar_fd, tar_bloom_t *bloom) {
+    if (tar_fd < 0 || tar_fd >= TAR_BLOOM_MAX_FD) {
+        errno = EBADF;
+        return -1;
+    }
+    __atomic_store_n(&attached[tar_fd], bloom, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * Returns the filter attached to an archive file descriptor.
+ *
+ * @param tar_fd The archive file descriptor.
+ *
+ * @return The attached filter, or NULL if there is none.
+ */
+const tar_bloom_t *tar_bloom_attached(int tar_fd) {
+    if (tar_fd < 0 || tar_fd >= TAR_BLOOM_MAX_FD) return NULL;
+    return __atomic_load_n(&attached[tar_fd], __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,120 @@
+#ifndef TAR_BLOOM_H
+#define TAR_BLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A Bloom filter block is one cache line: every lookup touches a single block */
+#define TAR_BLOOM_BLOCK_BITS 512
+#define TAR_BLOOM_BLOCK_WORDS (TAR_BLOOM_BLOCK_BITS / 64)
+/* Highest file descriptor a filter can be attached to */
+#define TAR_BLOOM_MAX_FD 1024
+
+typedef struct tar_bloom
+{
+    uint64_t nblocks;             /* number of 512-bit blocks */
+    uint32_t nhashes;             /* bits set per key, all inside the same block */
+    int64_t  archive_size;        /* identity of the archive the filter was built from */
+    int64_t  archive_mtime;
+    uint64_t *bits;               /* nblocks * TAR_BLOOM_BLOCK_WORDS words, cache-line aligned */
+} tar_bloom_t;
+
+/**
+ * Allocates an empty Bloom filter.
+ *
+ * @param expected Number of paths that will be added.
+ * @param fp_rate Target false-positive rate, strictly between 0 and 1 (e.g. 0.01).
+ *
+ * @return The new filter, or NULL if the arguments are invalid or memory runs out.
+ */
+tar_bloom_t *tar_bloom_new(size_t expected, double fp_rate);
+
+/**
+ * Releases a filter returned by tar_bloom_new, tar_bloom_build or tar_bloom_load.
+ *
+ * @param bloom The filter, may be NULL.
+ */
+void tar_bloom_free(tar_bloom_t *bloom);
+
+/**
+ * Adds a path to the filter.
+ *
+ * Only the first MAX_PATH_SIZE bytes of the path are significant, as for the
+ * name field of a header.
+ *
+ * @param bloom The filter.
+ * @param path The path of an archive entry.
+ */
+void tar_bloom_add(tar_bloom_t *bloom, const char *path);
+
+/**
+ * Tests whether a path may be in the filter.
+ *
+ * @param bloom The filter.
+ * @param path The path to look for.
+ *
+ * @return zero if the path is certainly not in the filter,
+ *         any other value if it may be (with the configured false-positive rate).
+ */
+int tar_bloom_may_contain(const tar_bloom_t *bloom, const char *path);
+
+/**
+ * Builds a filter holding the name of every entry of an archive.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param fp_rate Target false-positive rate, strictly between 0 and 1.
+ *
+ * @return The new filter, or NULL on error.
+ *
+ * Note: The archive is scanned once with next_header, the file offset is left at its end.
+ */
+tar_bloom_t *tar_bloom_build(int tar_fd, double fp_rate);
+
+/**
+ * Writes a filter to a sidecar file so it can be reused without rescanning the archive.
+ *
+ * @param bloom The filter.
+ * @param out_fd A file descriptor opened for writing.
+ *
+ * @return 0 on success, -1 on write error.
+ */
+int tar_bloom_save(const tar_bloom_t *bloom, int out_fd);
+
+/**
+ * Reads a filter written by tar_bloom_save.
+ *
+ * @param in_fd A file descriptor opened for reading, positioned at the saved filter.
+ * @param tar_fd The archive the filter is meant for, or -1 to skip the check.
+ *
+ * @return The filter, or NULL if it cannot be read, if its header is invalid (EINVAL: no blocks,
+ *         a block count that does not fit in memory or that is larger than the sidecar) or if it
+ *         was built from a different version of the archive (ESTALE: size or modification time changed).
+ */
+tar_bloom_t *tar_bloom_load(int in_fd, int tar_fd);
+
+/**
+ * Attaches a filter to an archive file descriptor.
+ *
+ * Once attached, get_header_type (and thus exists, is_dir, is_file, is_symlink,
+ * list and read_file) answers "not found" for paths rejected by the filter without
+ * scanning the archive.
+ *
+ * @param tar_fd The archive file descriptor, below TAR_BLOOM_MAX_FD.
+ * @param bloom The filter, it stays owned by the caller. NULL detaches.
+ *
+ * @return 0 on success, -1 if tar_fd is out of range.
+ *
+ * Note: Detach the filter before closing tar_fd, the table is indexed by descriptor number.
+ */
+int tar_bloom_attach(int tar_fd, tar_bloom_t *bloom);
+
+/**
+ * Returns the filter attached to an archive file descriptor.
+ *
+ * @param tar_fd The archive file descriptor.
+ *
+ * @return The attached filter, or NULL if there is none.
+ */
+const tar_bloom_t *tar_bloom_attached(int tar_fd);
+
+#endif
@@ -0,0 +1,421 @@
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "lib_tar.h"
+#include "tar_cache.h"
+
+#define TAR_CACHE_DEFAULT_SHARDS 16
+
+struct chunk
+{
+    uint64_t dev;                 /* archive identity */
+    uint64_t ino;
+    off_t offset;                 /* aligned on TAR_CACHE_CHUNK */
+    size_t len;                   /* valid bytes, less than a chunk only at the end of the archive */
+    struct chunk *hnext;          /* hash bucket chain */
+    struct chunk *prev, *next;    /* LRU list, most recently used first */
+    uint8_t data[TAR_CACHE_CHUNK];
+};
+
+struct shard
+{
+    pthread_mutex_t lock;
+    struct chunk **buckets;
+    size_t nbuckets;              /* power of two */
+    struct chunk lru;             /* sentinel of the LRU list */
+    size_t bytes;
+    size_t budget;
+    uint64_t hits, misses, evictions;
+} __attribute__((aligned(64)));
+
+struct tar_cache
+{
+    unsigned int nshards;
+    struct shard *shards;
+};
+
+struct attachment
+{
+    tar_cache_t *cache;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;                 /* archive size and modification time when last validated */
+    int64_t mtime;
+    off_t position;               /* scan position, kept here instead of in the file offset */
+};
+
+static struct attachment attached[TAR_CACHE_MAX_FD];
+static pthread_rwlock_t attach_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static uint64_t hash_key(uint64_t dev, uint64_t ino, off_t offset) {
+    uint64_t h = (dev * 0x9e3779b97f4a7c15ULL) ^ (ino * 0xc2b2ae3d27d4eb4fULL) ^ ((uint64_t)offset / TAR_CACHE_CHUNK);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static void lru_unlink(struct chunk *c) {
+    c->prev->next = c->next;
+    c->next->prev = c->prev;
+}
+
+static void lru_push_front(struct shard *s, struct chunk *c) {
+    c->next = s->lru.next;
+    c->prev = &s->lru;
+    s->lru.next->prev = c;
+    s->lru.next = c;
+}
+
+static struct chunk **bucket_of(struct shard *s, uint64_t h) {
+    return &s->buckets[(h >> 16) & (s->nbuckets - 1)];
+}
+
+static void evict_one(struct shard *s) {
+    struct chunk *victim = s->lru.prev;
+    lru_unlink(victim);
+    struct chunk **p = bucket_of(s, hash_key(victim->dev, victim->ino, victim->offset));
+    while (*p != victim) p = &(*p)->hnext;
+    *p = victim->hnext;
+    s->bytes -= sizeof(struct chunk);
+    s->evictions++;
+    free(victim);
+}
+
+static struct chunk *find(struct shard *s, uint64_t h, uint64_t dev, uint64_t ino, off_t chunk_off) {
+    for (struct chunk *c = *bucket_of(s, h); c != NULL; c = c->hnext) {
+        if (c->offset == chunk_off && c->ino == ino && c->dev == dev) return c;
+    }
+    return NULL;
+}
+
+static size_t copy_out(const struct chunk *c, size_t in_chunk, uint8_t *dest, size_t len) {
+    if (in_chunk >= c->len) return 0;
+    size_t n = c->len - in_chunk < len ? c->len - in_chunk : len;
+    memcpy(dest, c->data + in_chunk, n);
+    return n;
+}
+
+static ssize_t cache_read(tar_cache_t *cache, uint64_t dev, uint64_t ino, int tar_fd,
+                          void *buf, size_t len, off_t offset) {
+    uint8_t *dest = buf;
+    size_t done = 0;
+    while (done < len) {
+        off_t pos = offset + (off_t)done;
+        off_t chunk_off = pos - pos % TAR_CACHE_CHUNK;
+        size_t in_chunk = (size_t)(pos - chunk_off);
+        size_t want = len - done < TAR_CACHE_CHUNK - in_chunk ? len - done : TAR_CACHE_CHUNK - in_chunk;
+        uint64_t h = hash_key(dev, ino, chunk_off);
+        struct shard *s = &cache->shards[h % cache->nshards];
+
+        ssize_t n = -1;
+        pthread_mutex_lock(&s->lock);
+        struct chunk *hit = find(s, h, dev, ino, chunk_off);
+        if (hit != NULL) {
+            lru_unlink(hit);
+            lru_push_front(s, hit);
+            s->hits++;
+            n = (ssize_t)copy_out(hit, in_chunk, dest + done, want);
+        }
+        pthread_mutex_unlock(&s->lock);
+
+        if (n < 0) {
+            // Read the whole chunk without holding the shard lock
+            struct chunk *c = malloc(sizeof(struct chunk));
+            if (c == NULL) return -1;
+            ssize_t got;
+            do {
+                got = pread(tar_fd, c->data, TAR_CACHE_CHUNK, chunk_off);
+            } while (got < 0 && errno == EINTR);
+            if (got < 0) {
+                free(c);
+                return -1;
+            }
+            c->dev = dev;
+            c->ino = ino;
+            c->offset = chunk_off;
+            c->len = (size_t)got;
+            n = (ssize_t)copy_out(c, in_chunk, dest + done, want);
+
+            pthread_mutex_lock(&s->lock);
+            s->misses++;
+            if (find(s, h, dev, ino, chunk_off) != NULL) {
+                // Another reader inserted it meanwhile
+                free(c);
+            } else {
+                struct chunk **bucket = bucket_of(s, h);
+                c->hnext = *bucket;
+                *bucket = c;
+                lru_push_front(s, c);
+                s->bytes += sizeof(struct chunk);
+                while (s->bytes > s->budget && s->lru.prev != c) evict_one(s);
+            }
+            pthread_mutex_unlock(&s->lock);
+        }
+        if (n == 0) break; // end of the archive
+        done += (size_t)n;
+        if ((size_t)n < want) break;
+    }
+    return (ssize_t)done;
+}
+
+/**
+ * Creates a block cache.
+ *
+ * @param budget Maximum number of bytes of archive data kept in memory.
+ * @param nshards Number of shards, 0 picks a default.
+ *
+ * @return The new cache, or NULL on error.
+ */
+tar_cache_t *tar_cache_new(size_t budget, unsigned int nshards) {
+    if (nshards == 0) nshards = TAR_CACHE_DEFAULT_SHARDS;
+    tar_cache_t *cache = calloc(1, sizeof(tar_cache_t));
+    if (cache == NULL) return NULL;
+    cache->shards = aligned_alloc(64, nshards * sizeof(struct shard));
+    if (cache->shards == NULL) {
+        free(cache);
+        return NULL;
+    }
+    cache->nshards = nshards;
+
+    size_t per_shard = budget / nshards;
+    size_t nbuckets = 16;
+    while (nbuckets < per_shard / TAR_CACHE_CHUNK) nbuckets *= 2;
+    for (unsigned int i = 0; i < nshards; ++i) {
+        struct shard *s = &cache->shards[i];
+        memset(s, 0, sizeof(*s));
+        pthread_mutex_init(&s->lock, NULL);
+        s->lru.next = s->lru.prev = &s->lru;
+        s->budget = per_shard;
+        s->nbuckets = nbuckets;
+        s->buckets = calloc(nbuckets, sizeof(struct chunk *));
+        if (s->buckets == NULL) {
+            cache->nshards = i + 1;
+            tar_cache_free(cache);
+            return NULL;
+        }
+    }
+    return cache;
+}
+
+/**
+ * Drops every chunk from the cache.
+ *
+ * @param cache The cache.
+ */
+void tar_cache_clear(tar_cache_t *cache) {
+    for (unsigned int i = 0; i < cache->nshards; ++i) {
+        struct shard *s = &cache->shards[i];
+        pthread_mutex_lock(&s->lock);
+        while (s->lru.next != &s->lru) evict_one(s);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+/* Drops the chunks of one archive from every shard */
+static void drop_archive(tar_cache_t *cache, uint64_t dev, uint64_t ino) {
+    for (unsigned int i = 0; i < cache->nshards; ++i) {
+        struct shard *s = &cache->shards[i];
+        pthread_mutex_lock(&s->lock);
+        for (size_t b = 0; b < s->nbuckets; ++b) {
+            struct chunk **p = &s->buckets[b];
+            while (*p != NULL) {
+                struct chunk *c = *p;
+                if (c->dev != dev || c->ino != ino) {
+                    p = &c->hnext;
+                    continue;
+                }
+                *p = c->hnext;
+                lru_unlink(c);
+                s->bytes -= sizeof(struct chunk);
+                s->evictions++;
+                free(c);
+            }
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+/**
+ * Releases a cache and everything it holds.
+ *
+ * @param cache The cache, may be NULL.
+ */
+void tar_cache_free(tar_cache_t *cache) {
+    if (cache == NULL) return;
+    for (unsigned int i = 0; i < cache->nshards; ++i) {
+        struct shard *s = &cache->shards[i];
+        if (s->buckets != NULL) {
+            while (s->lru.next != &s->lru) evict_one(s);
+            free(s->buckets);
+        }
+        pthread_mutex_destroy(&s->lock);
+    }
+    free(cache->shards);
+    free(cache);
+}
+
+/**
+ * Reads archive data through the cache.
+ *
+ * @param cache The cache.
+ * @param tar_fd File descriptor for the TAR archive.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read.
+ * @param offset Offset in the archive to read from.
+ *
+ * @return The number of bytes read, short only at the end of the archive, or -1 on error.
+ */
+ssize_t tar_cache_pread(tar_cache_t *cache, int tar_fd, void *buf, size_t len, off_t offset) {
+    struct stat st;
+    if (fstat(tar_fd, &st) == -1) return -1;
+    return cache_read(cache, st.st_dev, st.st_ino, tar_fd, buf, len, offset);
+}
+
+/**
+ * Returns the counters of a cache.
+ *
+ * @param cache The cache.
+ * @param stats Out argument, set to the sum of the counters of all shards.
+ */
+void tar_cache_get_stats(tar_cache_t *cache, tar_cache_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (unsigned int i = 0; i < cache->nshards; ++i) {
+        struct shard *s = &cache->shards[i];
+        pthread_mutex_lock(&s->lock);
+        stats->hits += s->hits;
+        stats->misses += s->misses;
+        stats->evictions += s->evictions;
+        stats->bytes += s->bytes;
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+/**
+ * Attaches a cache to an archive file descriptor.
+ *
+ * @param tar_fd The archive file descriptor, below TAR_CACHE_MAX_FD.
+ * @param cache The cache, it stays owned by the caller. NULL detaches.
+ *
+ * @return 0 on success, -1 if tar_fd is out of range or cannot be stat'ed.
+ */
+int tar_cache_attach(int tar_fd, tar_cache_t *cache) {
+    if (tar_fd < 0 || tar_fd >= TAR_CACHE_MAX_FD) {
+        errno = EBADF;
+        return -1;
+    }
+    struct stat st;
+    off_t position = 0;
+    if (cache != NULL) {
+        if (fstat(tar_fd, &st) == -1) return -1;
+        position = lseek(tar_fd, 0, SEEK_CUR);
+        if (position == -1) position = 0;
+    }
+    pthread_rwlock_wrlock(&attach_lock);
+    attached[tar_fd].cache = cache;
+    if (cache != NULL) {
+        attached[tar_fd].dev = st.st_dev;
+        attached[tar_fd].ino = st.st_ino;
+        attached[tar_fd].size = st.st_size;
+        attached[tar_fd].mtime = st.st_mtime;
+        attached[tar_fd].position = position;
+    }
+    pthread_rwlock_unlock(&attach_lock);
+    return 0;
+}
+
+/**
+ * Drops the cached chunks of an archive if it changed since they were read.
+ *
+ * @param tar_fd The archive file descriptor.
+ *
+ * @return 0 if the archive did not change, 1 if its chunks were dropped,
+ *         -1 if no cache is attached to tar_fd or it cannot be stat'ed.
+ */
+int tar_cache_revalidate(int tar_fd) {
+    if (tar_fd < 0 || tar_fd >= TAR_CACHE_MAX_FD) return -1;
+    struct stat st;
+    if (fstat(tar_fd, &st) == -1) return -1;
+    pthread_rwlock_wrlock(&attach_lock);
+    struct attachment *a = &attached[tar_fd];
+    int changed = -1;
+    if (a->cache != NULL) {
+        changed = a->size != st.st_size || a->mtime != st.st_mtime;
+        a->size = st.st_size;
+        a->mtime = st.st_mtime;
+        // Chunks are keyed by dev and ino, stale ones would otherwise be served forever
+        if (changed) drop_archive(a->cache, a->dev, a->ino);
+    }
+    pthread_rwlock_unlock(&attach_lock);
+    return changed;
+}
+
+/**
+ * Returns the scan position of a descriptor with an attached cache.
+ *
+ * @param tar_fd The archive file descriptor.
+ *
+ * @return The position, or -1 if no cache is attached to tar_fd.
+ */
+off_t tar_cache_tell(int tar_fd) {
+    if (tar_fd < 0 || tar_fd >= TAR_CACHE_MAX_FD) return -1;
+    pthread_rwlock_rdlock(&attach_lock);
+    off_t position = attached[tar_fd].cache != NULL ? __atomic_load_n(&attached[tar_fd].position, __ATOMIC_RELAXED) : -1;
+    pthread_rwlock_unlock(&attach_lock);
+    return position;
+}
+
+/**
+ * Moves the scan position of a descriptor with an attached cache.
+ *
+ * @param tar_fd The archive file descriptor.
+ * @param position The new position, from the start of the archive.
+ *
+ * @return The new position, or -1 if no cache is attached to tar_fd or position is negative.
+ */
+off_t tar_cache_seek(int tar_fd, off_t position) {
+    if (tar_fd < 0 || tar_fd >= TAR_CACHE_MAX_FD || position < 0) return -1;
+    pthread_rwlock_rdlock(&attach_lock);
+    int has_cache = attached[tar_fd].cache != NULL;
+    if (has_cache) __atomic_store_n(&attached[tar_fd].position, position, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&attach_lock);
+    return has_cache ? position : -1;
+}
+
+/**
+ * Reads archive data, through the cache attached to the descriptor if there is one.
+ *
+ * @param tar_fd File descriptor for the TAR archive.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read.
+ * @param offset Offset in the archive to read from.
+ *
+ * @return The number of bytes read, or -1 on error.
+ */
+ssize_t tar_cached_pread(int tar_fd, void *buf, size_t len, off_t offset) {
+    struct attachment a = {NULL, 0, 0};
+    if (tar_fd >= 0 && tar_fd < TAR_CACHE_MAX_FD && len <= TAR_CACHE_MAX_READ) {
+        pthread_rwlock_rdlock(&attach_lock);
+        a = attached[tar_fd];
+        pthread_rwlock_unlock(&attach_lock);
+    }
+    if (a.cache == NULL) return pread(tar_fd, buf, len, offset);
+    return cache_read(a.cache, a.dev, a.ino, tar_fd, buf, len, offset);
+}
+
+/**
+ * Returns the cache attached to an archive file descriptor.
+ *
+ * @param tar_fd The archive file descriptor.
+ *
+ * @return The attached cache, or NULL if there is none.
+ */
+tar_cache_t *tar_cache_attached(int tar_fd) {
+    if (tar_fd < 0 || tar_fd >= TAR_CACHE_MAX_FD) return NULL;
+    pthread_rwlock_rdlock(&attach_lock);
+    tar_cache_t *cache = attached[tar_fd].cache;
+    pthread_rwlock_unlock(&attach_lock);
+    return cache;
+}
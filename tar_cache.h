@@ -0,0 +1,158 @@
+#ifndef TAR_CACHE_H
+#define TAR_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* The cache holds aligned chunks of archive data of this size */
+#define TAR_CACHE_CHUNK 4096
+/* Reads larger than this bypass the cache, it is meant for headers and small entries */
+#define TAR_CACHE_MAX_READ (64 * 1024)
+/* Highest file descriptor a cache can be attached to */
+#define TAR_CACHE_MAX_FD 1024
+
+typedef struct tar_cache tar_cache_t;
+
+typedef struct tar_cache_stats
+{
+    uint64_t hits;                /* chunks served from memory */
+    uint64_t misses;              /* chunks read from the archive */
+    uint64_t evictions;           /* chunks dropped to stay within the budget */
+    uint64_t bytes;               /* memory currently used by cached chunks */
+} tar_cache_stats_t;
+
+/**
+ * Creates a block cache.
+ *
+ * The cache is split into independently locked shards so concurrent readers rarely
+ * contend. Each shard evicts its least recently used chunks to stay within its share
+ * of the budget. A cache can be shared by any number of archives and threads.
+ *
+ * @param budget Maximum number of bytes of archive data kept in memory.
+ * @param nshards Number of shards, 0 picks a default.
+ *
+ * @return The new cache, or NULL on error.
+ */
+tar_cache_t *tar_cache_new(size_t budget, unsigned int nshards);
+
+/**
+ * Releases a cache and everything it holds.
+ *
+ * @param cache The cache, may be NULL. It must not be attached to any descriptor anymore.
+ */
+void tar_cache_free(tar_cache_t *cache);
+
+/**
+ * Drops every chunk from the cache, e.g. after an archive was rewritten in place.
+ *
+ * @param cache The cache.
+ *
+ * Note: Descriptors with the cache attached also notice a change of size or modification
+ *       time of their archive by themselves, see tar_cache_revalidate.
+ */
+void tar_cache_clear(tar_cache_t *cache);
+
+/**
+ * Reads archive data through the cache.
+ *
+ * Chunks are keyed by archive identity (device and inode) and offset, so two
+ * descriptors opened on the same archive share their cached chunks.
+ *
+ * @param cache The cache.
+ * @param tar_fd File descriptor for the TAR archive.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read.
+ * @param offset Offset in the archive to read from.
+ *
+ * @return The number of bytes read, short only at the end of the archive, or -1 on error.
+ *
+ * Note: Does not move the file offset of tar_fd.
+ */
+ssize_t tar_cache_pread(tar_cache_t *cache, int tar_fd, void *buf, size_t len, off_t offset);
+
+/**
+ * Returns the counters of a cache.
+ *
+ * @param cache The cache.
+ * @param stats Out argument, set to the sum of the counters of all shards.
+ */
+void tar_cache_get_stats(tar_cache_t *cache, tar_cache_stats_t *stats);
+
+/**
+ * Attaches a cache to an archive file descriptor.
+ *
+ * Once attached, header reads and small read_file reads on tar_fd are served
+ * through the cache. Header scans then keep their position next to the attachment
+ * (see tar_cache_tell) instead of in the file offset of tar_fd, so walking the
+ * headers of a cached archive makes no system call at all.
+ *
+ * @param tar_fd The archive file descriptor, below TAR_CACHE_MAX_FD.
+ * @param cache The cache, it stays owned by the caller. NULL detaches.
+ *
+ * @return 0 on success, -1 if tar_fd is out of range or cannot be stat'ed.
+ *
+ * Note: Detach the cache before closing tar_fd, the table is indexed by descriptor number.
+ *       The file offset of tar_fd is not moved by the library while a cache is attached.
+ */
+int tar_cache_attach(int tar_fd, tar_cache_t *cache);
+
+/**
+ * Drops the cached chunks of an archive if it changed since they were read.
+ *
+ * The size and modification time of the archive are recorded when the cache is
+ * attached and compared here, as tar_bloom_load does for its sidecar. go_back_start
+ * calls it before every scan of a cached archive.
+ *
+ * @param tar_fd The archive file descriptor.
+ *
+ * @return 0 if the archive did not change, 1 if its chunks were dropped,
+ *         -1 if no cache is attached to tar_fd or it cannot be stat'ed.
+ */
+int tar_cache_revalidate(int tar_fd);
+
+/**
+ * Returns the scan position of a descriptor with an attached cache.
+ *
+ * @param tar_fd The archive file descriptor.
+ *
+ * @return The position, or -1 if no cache is attached to tar_fd.
+ *
+ * Note: Like the file offset it replaces, the position is shared by every user of tar_fd.
+ */
+off_t tar_cache_tell(int tar_fd);
+
+/**
+ * Moves the scan position of a descriptor with an attached cache.
+ *
+ * @param tar_fd The archive file descriptor.
+ * @param position The new position, from the start of the archive.
+ *
+ * @return The new position, or -1 if no cache is attached to tar_fd or position is negative.
+ */
+off_t tar_cache_seek(int tar_fd, off_t position);
+
+/**
+ * Returns the cache attached to an archive file descriptor.
+ *
+ * @param tar_fd The archive file descriptor.
+ *
+ * @return The attached cache, or NULL if there is none.
+ */
+tar_cache_t *tar_cache_attached(int tar_fd);
+
+/**
+ * Reads archive data, through the cache attached to the descriptor if there is one.
+ *
+ * @param tar_fd File descriptor for the TAR archive.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read.
+ * @param offset Offset in the archive to read from.
+ *
+ * @return The number of bytes read, or -1 on error.
+ *
+ * Note: Reads larger than TAR_CACHE_MAX_READ always go straight to the archive.
+ */
+ssize_t tar_cached_pread(int tar_fd, void *buf, size_t len, off_t offset);
+
+#endif
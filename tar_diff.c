@@ -0,0 +1,163 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tar_diff.h"
+#include "tar_index.h"
+#include "tar_workers.h"
+
+/* A pair of same-size regular files whose bytes must be compared */
+struct candidate
+{
+    const tar_entry_t *a;
+    const tar_entry_t *b;
+    size_t result;                /* index in the changes array to update */
+};
+
+struct comparison
+{
+    int fd_a, fd_b;
+    struct candidate *candidates;
+    size_t count;
+    size_t next;                  /* next candidate to hand out, atomically incremented */
+    int *changes;
+    int error;
+};
+
+static int read_full(int fd, uint8_t *buf, size_t len, off_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, buf + done, len - done, offset + (off_t)done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) {
+            errno = EIO; // the archive is shorter than its headers say
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+/* Returns 1 if the data differ, 0 if not, -1 on error */
+static int data_differ(struct comparison *c, const tar_entry_t *a, const tar_entry_t *b, uint8_t *buf_a, uint8_t *buf_b) {
+    for (int64_t done = 0; done < a->size; done += TAR_DIFF_CHUNK) {
+        size_t len = a->size - done < TAR_DIFF_CHUNK ? (size_t)(a->size - done) : TAR_DIFF_CHUNK;
+        if (read_full(c->fd_a, buf_a, len, a->data_offset + done) == -1) return -1;
+        if (read_full(c->fd_b, buf_b, len, b->data_offset + done) == -1) return -1;
+        if (memcmp(buf_a, buf_b, len) != 0) return 1;
+    }
+    return 0;
+}
+
+static void *compare_worker(void *arg) {
+    struct comparison *c = arg;
+    uint8_t *buf_a = malloc(TAR_DIFF_CHUNK), *buf_b = malloc(TAR_DIFF_CHUNK);
+    if (buf_a == NULL || buf_b == NULL) {
+        __atomic_store_n(&c->error, ENOMEM, __ATOMIC_RELAXED);
+    }
+    while (buf_a != NULL && buf_b != NULL && !__atomic_load_n(&c->error, __ATOMIC_RELAXED)) {
+        size_t i = __atomic_fetch_add(&c->next, 1, __ATOMIC_RELAXED);
+        if (i >= c->count) break;
+        struct candidate *candidate = &c->candidates[i];
+        int differ = data_differ(c, candidate->a, candidate->b, buf_a, buf_b);
+        if (differ == -1) __atomic_store_n(&c->error, errno, __ATOMIC_RELAXED);
+        else if (differ) c->changes[candidate->result] |= TAR_CHANGED_CONTENT;
+    }
+    free(buf_a);
+    free(buf_b);
+    return NULL;
+}
+
+static int compare_candidates(struct comparison *c, unsigned int nthreads) {
+    if (c->count == 0) return 0;
+    tar_run_workers(nthreads, c->count, compare_worker, c);
+    if (c->error != 0) {
+        errno = c->error;
+        return -1;
+    }
+    return 0;
+}
+
+static int header_changes(const tar_entry_t *a, const tar_entry_t *b) {
+    int changes = 0;
+    if (tar_entry_type(a) != tar_entry_type(b)) changes |= TAR_CHANGED_TYPE;
+    if (a->size != b->size) changes |= TAR_CHANGED_SIZE;
+    if ((a->mode & 07777) != (b->mode & 07777)) changes |= TAR_CHANGED_MODE;
+    if (a->mtime != b->mtime) changes |= TAR_CHANGED_MTIME;
+    if ((a->typeflag == SYMTYPE || a->typeflag == LNKTYPE) && strcmp(a->linkname, b->linkname) != 0) {
+        changes |= TAR_CHANGED_LINK;
+    }
+    return changes;
+}
+
+/**
+ * Compares two archives entry by entry.
+ *
+ * @param fd_a A file descriptor on the first (older) archive.
+ * @param fd_b A file descriptor on the second (newer) archive.
+ * @param flags Zero or TAR_DIFF_TRUST_MTIME.
+ * @param nthreads Number of comparison threads, 0 uses one per online CPU.
+ * @param callback Called for every difference.
+ * @param arg Passed to callback.
+ *
+ * @return The number of differences reported, or -1 on error (errno is set).
+ */
+ssize_t tar_diff(int fd_a, int fd_b, int flags, unsigned int nthreads, tar_diff_cb callback, void *arg) {
+    if (callback == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    tar_index_t *a = tar_index_build(fd_a);
+    tar_index_t *b = a != NULL ? tar_index_build(fd_b) : NULL;
+    int *changes = b != NULL ? calloc(a->count ? a->count : 1, sizeof(int)) : NULL;
+    struct candidate *candidates = changes != NULL ? malloc((a->count ? a->count : 1) * sizeof(struct candidate)) : NULL;
+    ssize_t reported = -1;
+    if (candidates == NULL) goto out;
+
+    // Header pass: everything but the content is known after it
+    struct comparison c = {fd_a, fd_b, candidates, 0, 0, changes, 0};
+    for (size_t i = 0; i < a->count; ++i) {
+        const tar_entry_t *entry_a = &a->entries[i];
+        if (tar_index_lookup(a, entry_a->name) != entry_a) continue; // shadowed duplicate
+        const tar_entry_t *entry_b = tar_index_lookup(b, entry_a->name);
+        if (entry_b == NULL) continue;
+        changes[i] = header_changes(entry_a, entry_b);
+        int same_size_files = tar_entry_type(entry_a) == 1 && tar_entry_type(entry_b) == 1 && entry_a->size == entry_b->size;
+        int trusted = (flags & TAR_DIFF_TRUST_MTIME) && !(changes[i] & TAR_CHANGED_MTIME);
+        if (same_size_files && entry_a->size > 0 && !trusted) {
+            c.candidates[c.count++] = (struct candidate){entry_a, entry_b, i};
+        }
+    }
+    if (compare_candidates(&c, nthreads) == -1) goto out;
+
+    reported = 0;
+    tar_diff_entry_t diff;
+    for (size_t i = 0; i < a->count; ++i) {
+        const tar_entry_t *entry_a = &a->entries[i];
+        if (tar_index_lookup(a, entry_a->name) != entry_a) continue;
+        diff.path = entry_a->name;
+        diff.changes = changes[i];
+        if (tar_index_lookup(b, entry_a->name) == NULL) diff.kind = TAR_DIFF_REMOVED;
+        else if (changes[i] != 0) diff.kind = TAR_DIFF_CHANGED;
+        else continue;
+        reported++;
+        if (callback(&diff, arg) != 0) goto out;
+    }
+    for (size_t i = 0; i < b->count; ++i) {
+        const tar_entry_t *entry_b = &b->entries[i];
+        if (tar_index_lookup(b, entry_b->name) != entry_b || tar_index_lookup(a, entry_b->name) != NULL) continue;
+        diff.path = entry_b->name;
+        diff.kind = TAR_DIFF_ADDED;
+        diff.changes = 0;
+        reported++;
+        if (callback(&diff, arg) != 0) goto out;
+    }
+
+out:
+    free(candidates);
+    free(changes);
+    tar_index_free(b);
+    tar_index_free(a);
+    return reported;
+}
@@ -0,0 +1,66 @@
+#ifndef TAR_DIFF_H
+#define TAR_DIFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Kind of difference */
+#define TAR_DIFF_ADDED   1        /* only in the second archive */
+#define TAR_DIFF_REMOVED 2        /* only in the first archive */
+#define TAR_DIFF_CHANGED 3        /* in both, see the change bits */
+
+/* Change bits of a TAR_DIFF_CHANGED entry */
+#define TAR_CHANGED_TYPE    0x01
+#define TAR_CHANGED_SIZE    0x02
+#define TAR_CHANGED_MODE    0x04
+#define TAR_CHANGED_MTIME   0x08
+#define TAR_CHANGED_LINK    0x10  /* link target */
+#define TAR_CHANGED_CONTENT 0x20  /* same size, different bytes */
+
+/* Flags of tar_diff */
+#define TAR_DIFF_TRUST_MTIME 0x1  /* files with the same size and mtime are not compared byte by byte */
+
+/* Size of the blocks compared at once, the comparison stops at the first different block */
+#define TAR_DIFF_CHUNK (256 * 1024)
+
+typedef struct tar_diff_entry
+{
+    const char *path;
+    int kind;                     /* TAR_DIFF_ADDED, TAR_DIFF_REMOVED or TAR_DIFF_CHANGED */
+    int changes;                  /* TAR_CHANGED_* bits, zero unless kind is TAR_DIFF_CHANGED */
+} tar_diff_entry_t;
+
+/**
+ * Callback of tar_diff, called once per difference.
+ *
+ * @param diff The difference, only valid during the call.
+ * @param arg The argument given to tar_diff.
+ *
+ * @return zero to continue, any other value to stop.
+ */
+typedef int (*tar_diff_cb)(const tar_diff_entry_t *diff, void *arg);
+
+/**
+ * Compares two archives entry by entry.
+ *
+ * Both archives are indexed and their entries matched by path. Type, size, mode, mtime
+ * and link target are compared from the headers alone. The data of regular files is
+ * read only when both sides have the same size, and those comparisons run in parallel,
+ * each one stopping at its first different block.
+ *
+ * Differences are reported from the calling thread: removed and changed entries in the
+ * order of the first archive, then added entries in the order of the second one.
+ *
+ * @param fd_a A file descriptor on the first (older) archive.
+ * @param fd_b A file descriptor on the second (newer) archive.
+ * @param flags Zero or TAR_DIFF_TRUST_MTIME.
+ * @param nthreads Number of comparison threads, 0 uses one per online CPU.
+ * @param callback Called for every difference.
+ * @param arg Passed to callback.
+ *
+ * @return The number of differences reported, or -1 on error (errno is set).
+ */
+ssize_t tar_diff(int fd_a, int fd_b, int flags, unsigned int nthreads, tar_diff_cb callback, void *arg);
+
+#endif
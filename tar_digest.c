@@ -0,0 +1,496 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "lib_tar.h"
+#include "tar_digest.h"
+#include "tar_index.h"
+#include "tar_sidecar.h"
+#include "tar_workers.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define HAVE_CRC32C_INSTRUCTION 1
+#endif
+
+#define TAR_DIGEST_MAGIC "TARDGST1"
+#define TAR_DIGEST_VERSION 1
+
+/* Saved digests are a sidecar header (param: algorithm, count: records) followed by the records */
+
+#define CRC32C_POLY 0x82F63B78U   /* reflected Castagnoli polynomial */
+
+static uint32_t crc32c_table[256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+static int crc32c_hardware;
+
+static void crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; ++k) crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc32c_table[i] = crc;
+    }
+#ifdef HAVE_CRC32C_INSTRUCTION
+    crc32c_hardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint32_t crc32c_software(uint32_t crc, const uint8_t *p, size_t len) {
+    while (len--) crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef HAVE_CRC32C_INSTRUCTION
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hardware_update(uint32_t crc, const uint8_t *p, size_t len) {
+    uint64_t crc64 = crc;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+    for (; len > 0; ++p, --len) crc = _mm_crc32_u8(crc, *p);
+    return crc;
+}
+#endif
+
+/**
+ * Updates a CRC32C with more data.
+ *
+ * @param crc The CRC of the preceding data, 0 to start.
+ * @param buf The data.
+ * @param len Its length.
+ *
+ * @return The CRC of the preceding data followed by buf.
+ */
+uint32_t tar_crc32c(uint32_t crc, const void *buf, size_t len) {
+    pthread_once(&crc32c_once, crc32c_init);
+    crc = ~crc;
+#ifdef HAVE_CRC32C_INSTRUCTION
+    if (crc32c_hardware) return ~crc32c_hardware_update(crc, buf, len);
+#endif
+    return ~crc32c_software(crc, buf, len);
+}
+
+/* Multiplies a 32x32 matrix over GF(2) by a vector */
+static uint32_t gf2_times(const uint32_t *matrix, uint32_t vector) {
+    uint32_t sum = 0;
+    for (; vector != 0; vector >>= 1, ++matrix) {
+        if (vector & 1) sum ^= *matrix;
+    }
+    return sum;
+}
+
+static void gf2_square(uint32_t *square, const uint32_t *matrix) {
+    for (int n = 0; n < 32; ++n) square[n] = gf2_times(matrix, matrix[n]);
+}
+
+/**
+ * Combines the CRC32C of two consecutive pieces of data.
+ *
+ * @param crc_a The CRC of the first piece.
+ * @param crc_b The CRC of the second piece.
+ * @param len_b The length of the second piece.
+ *
+ * @return The CRC of the first piece followed by the second.
+ */
+uint32_t tar_crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b) {
+    // Appends len_b zero bytes to crc_a by squaring the one-bit shift operator (zlib's method)
+    uint32_t even[32], odd[32];
+    if (len_b == 0) return crc_a;
+    odd[0] = CRC32C_POLY;
+    for (int n = 1; n < 32; ++n) odd[n] = 1U << (n - 1);
+    gf2_square(even, odd);        /* two zero bits */
+    gf2_square(odd, even);        /* four zero bits */
+    do {
+        gf2_square(even, odd);
+        if (len_b & 1) crc_a = gf2_times(even, crc_a);
+        len_b >>= 1;
+        if (len_b == 0) break;
+        gf2_square(odd, even);
+        if (len_b & 1) crc_a = gf2_times(odd, crc_a);
+        len_b >>= 1;
+    } while (len_b != 0);
+    return crc_a ^ crc_b;
+}
+
+#define XXH_PRIME1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME3 0x165667B19E3779F9ULL
+#define XXH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME5 0x27D4EB2F165667C5ULL
+
+/* Streaming xxHash64 state, so a member can be hashed one read at a time */
+struct xxh64_state
+{
+    uint64_t total_len;
+    uint64_t v[4];
+    uint8_t buffered[32];
+    size_t nbuffered;
+    uint64_t seed;
+};
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME2;
+    return rotl64(acc, 31) * XXH_PRIME1;
+}
+
+static uint64_t xxh64_merge(uint64_t acc, uint64_t v) {
+    acc ^= xxh64_round(0, v);
+    return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+static void xxh64_reset(struct xxh64_state *state, uint64_t seed) {
+    memset(state, 0, sizeof(*state));
+    state->seed = seed;
+    state->v[0] = seed + XXH_PRIME1 + XXH_PRIME2;
+    state->v[1] = seed + XXH_PRIME2;
+    state->v[2] = seed;
+    state->v[3] = seed - XXH_PRIME1;
+}
+
+static void xxh64_stripe(struct xxh64_state *state, const uint8_t *p) {
+    for (int i = 0; i < 4; ++i) state->v[i] = xxh64_round(state->v[i], read64(p + 8 * i));
+}
+
+static void xxh64_update(struct xxh64_state *state, const uint8_t *p, size_t len) {
+    state->total_len += len;
+    if (state->nbuffered + len < 32) {
+        memcpy(state->buffered + state->nbuffered, p, len);
+        state->nbuffered += len;
+        return;
+    }
+    if (state->nbuffered > 0) {
+        size_t fill = 32 - state->nbuffered;
+        memcpy(state->buffered + state->nbuffered, p, fill);
+        xxh64_stripe(state, state->buffered);
+        p += fill;
+        len -= fill;
+        state->nbuffered = 0;
+    }
+    for (; len >= 32; p += 32, len -= 32) xxh64_stripe(state, p);
+    memcpy(state->buffered, p, len);
+    state->nbuffered = len;
+}
+
+static uint64_t xxh64_digest(const struct xxh64_state *state) {
+    uint64_t h;
+    if (state->total_len >= 32) {
+        const uint64_t *v = state->v;
+        h = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) + rotl64(v[3], 18);
+        for (int i = 0; i < 4; ++i) h = xxh64_merge(h, v[i]);
+    } else {
+        h = state->seed + XXH_PRIME5;
+    }
+    h += state->total_len;
+
+    const uint8_t *p = state->buffered;
+    size_t len = state->nbuffered;
+    for (; len >= 8; p += 8, len -= 8) h = rotl64(h ^ xxh64_round(0, read64(p)), 27) * XXH_PRIME1 + XXH_PRIME4;
+    if (len >= 4) {
+        h = rotl64(h ^ (uint64_t)read32(p) * XXH_PRIME1, 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+        len -= 4;
+    }
+    for (; len > 0; ++p, --len) h = rotl64(h ^ *p * XXH_PRIME5, 11) * XXH_PRIME1;
+
+    h ^= h >> 33;
+    h *= XXH_PRIME2;
+    h ^= h >> 29;
+    h *= XXH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+/**
+ * Computes the 64-bit xxHash of a buffer.
+ *
+ * @param buf The data.
+ * @param len Its length.
+ * @param seed The seed, tar_digest_all uses 0.
+ *
+ * @return The hash.
+ */
+uint64_t tar_xxh64(const void *buf, size_t len, uint64_t seed) {
+    struct xxh64_state state;
+    xxh64_reset(&state, seed);
+    xxh64_update(&state, buf, len);
+    return xxh64_digest(&state);
+}
+
+/* A byte range of one member, digested by a single thread */
+struct unit
+{
+    size_t entry;                 /* index of the member in the archive index */
+    uint64_t offset;              /* from the start of the member data */
+    uint64_t len;
+    uint64_t digest;
+};
+
+struct digest_job
+{
+    int tar_fd;
+    int algo;
+    const tar_index_t *index;
+    struct unit *units;
+    size_t count;
+    size_t next;                  /* next unit to hand out, atomically incremented */
+    int error;
+};
+
+static int digest_unit(struct digest_job *job, struct unit *unit, uint8_t *buffer) {
+    const tar_entry_t *entry = &job->index->entries[unit->entry];
+    struct xxh64_state state;
+    uint32_t crc = 0;
+    if (job->algo == TAR_DIGEST_XXH64) xxh64_reset(&state, 0);
+    for (uint64_t done = 0; done < unit->len;) {
+        size_t want = unit->len - done < TAR_DIGEST_READ ? (size_t)(unit->len - done) : TAR_DIGEST_READ;
+        ssize_t n = pread(job->tar_fd, buffer, want, entry->data_offset + (off_t)(unit->offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            __atomic_store_n(&job->error, n < 0 ? errno : EIO, __ATOMIC_RELAXED);
+            return -1;
+        }
+        if (job->algo == TAR_DIGEST_XXH64) xxh64_update(&state, buffer, (size_t)n);
+        else crc = tar_crc32c(crc, buffer, (size_t)n);
+        done += (uint64_t)n;
+    }
+    unit->digest = job->algo == TAR_DIGEST_XXH64 ? xxh64_digest(&state) : crc;
+    return 0;
+}
+
+static void *digest_worker(void *arg) {
+    struct digest_job *job = arg;
+    uint8_t *buffer = malloc(TAR_DIGEST_READ);
+    if (buffer == NULL) __atomic_store_n(&job->error, ENOMEM, __ATOMIC_RELAXED);
+    while (buffer != NULL && !__atomic_load_n(&job->error, __ATOMIC_RELAXED)) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->count) break;
+        if (digest_unit(job, &job->units[i], buffer) == -1) break;
+    }
+    free(buffer);
+    return NULL;
+}
+
+/* Digests every regular file of index, digests[i] receives the digest of entries[i] */
+static int compute_digests(int tar_fd, const tar_index_t *index, int algo, unsigned int nthreads, uint64_t *digests) {
+    size_t count = 0;
+    for (size_t i = 0; i < index->count; ++i) {
+        const tar_entry_t *entry = &index->entries[i];
+        if (tar_entry_type(entry) != 1 || tar_index_lookup(index, entry->name) != entry) continue;
+        count += algo == TAR_DIGEST_CRC32C && entry->size > TAR_DIGEST_CHUNK ? (entry->size + TAR_DIGEST_CHUNK - 1) / TAR_DIGEST_CHUNK : 1;
+    }
+    struct digest_job job = {tar_fd, algo, index, NULL, count, 0, 0};
+    job.units = malloc((count ? count : 1) * sizeof(struct unit));
+    if (job.units == NULL) return -1;
+    count = 0;
+    for (size_t i = 0; i < index->count; ++i) {
+        const tar_entry_t *entry = &index->entries[i];
+        if (tar_entry_type(entry) != 1 || tar_index_lookup(index, entry->name) != entry) continue;
+        uint64_t chunk = algo == TAR_DIGEST_CRC32C ? TAR_DIGEST_CHUNK : (uint64_t)entry->size;
+        uint64_t offset = 0;
+        do {
+            uint64_t len = (uint64_t)entry->size - offset < chunk ? (uint64_t)entry->size - offset : chunk;
+            job.units[count++] = (struct unit){i, offset, len, 0};
+            offset += len;
+        } while (offset < (uint64_t)entry->size);
+    }
+
+    tar_advise(tar_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    tar_run_workers(nthreads, count, digest_worker, &job);
+    tar_advise(tar_fd, 0, 0, POSIX_FADV_NORMAL);
+    if (job.error != 0) {
+        free(job.units);
+        errno = job.error;
+        return -1;
+    }
+
+    // Units are in archive order, the chunks of a member are consecutive
+    for (size_t u = 0; u < count; ++u) {
+        struct unit *unit = &job.units[u];
+        if (unit->offset == 0) digests[unit->entry] = unit->digest;
+        else digests[unit->entry] = tar_crc32c_combine((uint32_t)digests[unit->entry], (uint32_t)unit->digest, unit->len);
+    }
+    free(job.units);
+    return 0;
+}
+
+static uint64_t *digest_index(int tar_fd, const tar_index_t *index, int algo, unsigned int nthreads) {
+    if (algo != TAR_DIGEST_CRC32C && algo != TAR_DIGEST_XXH64) {
+        errno = EINVAL;
+        return NULL;
+    }
+    uint64_t *digests = calloc(index->count ? index->count : 1, sizeof(uint64_t));
+    if (digests == NULL) return NULL;
+    if (compute_digests(tar_fd, index, algo, nthreads, digests) == -1) {
+        free(digests);
+        return NULL;
+    }
+    return digests;
+}
+
+/**
+ * Computes a digest of the data of every regular file of an archive.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param algo TAR_DIGEST_CRC32C or TAR_DIGEST_XXH64.
+ * @param nthreads Number of threads, 0 uses one per online CPU.
+ * @param callback Called for every regular file.
+ * @param arg Passed to callback.
+ *
+ * @return The number of digests reported, or -1 on error (errno is set).
+ */
+ssize_t tar_digest_all(int tar_fd, int algo, unsigned int nthreads, tar_digest_cb callback, void *arg) {
+    if (callback == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    tar_index_t *index = tar_index_build(tar_fd);
+    if (index == NULL) return -1;
+    uint64_t *digests = digest_index(tar_fd, index, algo, nthreads);
+    if (digests == NULL) {
+        tar_index_free(index);
+        return -1;
+    }
+    ssize_t reported = 0;
+    for (size_t i = 0; i < index->count; ++i) {
+        const tar_entry_t *entry = &index->entries[i];
+        if (tar_entry_type(entry) != 1 || tar_index_lookup(index, entry->name) != entry) continue;
+        reported++;
+        if (callback(entry->name, digests[i], arg) != 0) break;
+    }
+    free(digests);
+    tar_index_free(index);
+    return reported;
+}
+
+/**
+ * Computes the digests of an archive like tar_digest_all and keeps them in memory.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param algo TAR_DIGEST_CRC32C or TAR_DIGEST_XXH64.
+ * @param nthreads Number of threads, 0 uses one per online CPU.
+ *
+ * @return The digests, or NULL on error (errno is set).
+ */
+tar_digests_t *tar_digests_build(int tar_fd, int algo, unsigned int nthreads) {
+    tar_index_t *index = tar_index_build(tar_fd);
+    if (index == NULL) return NULL;
+    uint64_t *digests = digest_index(tar_fd, index, algo, nthreads);
+    tar_digests_t *result = digests != NULL ? calloc(1, sizeof(tar_digests_t)) : NULL;
+    if (result != NULL) result->records = malloc((index->count ? index->count : 1) * sizeof(tar_digest_record_t));
+    if (result == NULL || result->records == NULL) {
+        free(result);
+        free(digests);
+        tar_index_free(index);
+        return NULL;
+    }
+    result->algo = algo;
+    result->archive_size = index->archive_size;
+    result->archive_mtime = index->archive_mtime;
+    // Entries are in archive order, so the records come out sorted by data offset
+    for (size_t i = 0; i < index->count; ++i) {
+        const tar_entry_t *entry = &index->entries[i];
+        if (tar_entry_type(entry) != 1 || tar_index_lookup(index, entry->name) != entry) continue;
+        result->records[result->count++] = (tar_digest_record_t){(uint64_t)entry->data_offset, (uint64_t)entry->size, digests[i]};
+    }
+    free(digests);
+    tar_index_free(index);
+    return result;
+}
+
+/**
+ * Releases digests returned by tar_digests_build or tar_digests_load.
+ *
+ * @param digests The digests, may be NULL.
+ */
+void tar_digests_free(tar_digests_t *digests) {
+    if (digests == NULL) return;
+    free(digests->records);
+    free(digests);
+}
+
+/**
+ * Finds the digest of a member.
+ *
+ * @param digests The digests.
+ * @param data_offset The offset of the member data, as given by the index.
+ *
+ * @return The record, or NULL if the member is not a regular file of the archive.
+ */
+const tar_digest_record_t *tar_digests_find(const tar_digests_t *digests, uint64_t data_offset) {
+    size_t low = 0, high = digests->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (digests->records[middle].data_offset < data_offset) low = middle + 1;
+        else high = middle;
+    }
+    if (low < digests->count && digests->records[low].data_offset == data_offset) return &digests->records[low];
+    return NULL;
+}
+
+/**
+ * Writes digests to a sidecar file so they can be reused without rereading the archive.
+ *
+ * @param digests The digests.
+ * @param out_fd A file descriptor opened for writing.
+ *
+ * @return 0 on success, -1 on write error.
+ */
+int tar_digests_save(const tar_digests_t *digests, int out_fd) {
+    if (tar_sidecar_write(out_fd, TAR_DIGEST_MAGIC, TAR_DIGEST_VERSION, (uint32_t)digests->algo, digests->count,
+                          digests->archive_size, digests->archive_mtime) == -1) return -1;
+    return tar_write_all(out_fd, digests->records, digests->count * sizeof(tar_digest_record_t));
+}
+
+/**
+ * Reads digests written by tar_digests_save.
+ *
+ * @param in_fd A file descriptor opened for reading, positioned at the saved digests.
+ * @param tar_fd The archive the digests are meant for, or -1 to skip the check.
+ *
+ * @return The digests, or NULL if they cannot be read or if they were computed from a
+ *         different version of the archive (errno is ESTALE).
+ */
+tar_digests_t *tar_digests_load(int in_fd, int tar_fd) {
+    tar_sidecar_header_t file;
+    if (tar_sidecar_read(in_fd, TAR_DIGEST_MAGIC, TAR_DIGEST_VERSION, sizeof(tar_digest_record_t), tar_fd, &file) == -1) {
+        return NULL;
+    }
+    if (file.param != TAR_DIGEST_CRC32C && file.param != TAR_DIGEST_XXH64) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    tar_digests_t *digests = calloc(1, sizeof(tar_digests_t));
+    if (digests == NULL) return NULL;
+    digests->records = malloc((file.count ? file.count : 1) * sizeof(tar_digest_record_t));
+    if (digests->records == NULL || tar_read_all(in_fd, digests->records, file.count * sizeof(tar_digest_record_t)) == -1) {
+        tar_digests_free(digests);
+        return NULL;
+    }
+    digests->algo = (int)file.param;
+    digests->count = file.count;
+    digests->archive_size = file.archive_size;
+    digests->archive_mtime = file.archive_mtime;
+    return digests;
+}
@@ -0,0 +1,147 @@
+#ifndef TAR_DIGEST_H
+#define TAR_DIGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Digest algorithms */
+#define TAR_DIGEST_CRC32C 1       /* Castagnoli CRC, SSE4.2 instruction when available */
+#define TAR_DIGEST_XXH64  2       /* 64-bit xxHash, seed 0 */
+
+/* Members larger than this are split among threads (CRC32C only, see tar_digest_all) */
+#define TAR_DIGEST_CHUNK (4 * 1024 * 1024)
+/* Size of the reads issued by each digest thread */
+#define TAR_DIGEST_READ (1024 * 1024)
+
+/* Digest of one member as stored in a sidecar file */
+typedef struct tar_digest_record
+{
+    uint64_t data_offset;         /* identifies the member inside the archive */
+    uint64_t size;
+    uint64_t digest;
+} tar_digest_record_t;
+
+typedef struct tar_digests
+{
+    int algo;
+    size_t count;
+    int64_t archive_size;         /* identity of the archive the digests were computed from */
+    int64_t archive_mtime;
+    tar_digest_record_t *records; /* sorted by data_offset */
+} tar_digests_t;
+
+/**
+ * Callback of tar_digest_all, called once per regular file.
+ *
+ * @param path The path of the member.
+ * @param digest Its digest, a CRC32C is stored in the low 32 bits.
+ * @param arg The argument given to tar_digest_all.
+ *
+ * @return zero to continue, any other value to stop.
+ */
+typedef int (*tar_digest_cb)(const char *path, uint64_t digest, void *arg);
+
+/**
+ * Updates a CRC32C with more data.
+ *
+ * @param crc The CRC of the preceding data, 0 to start.
+ * @param buf The data.
+ * @param len Its length.
+ *
+ * @return The CRC of the preceding data followed by buf.
+ */
+uint32_t tar_crc32c(uint32_t crc, const void *buf, size_t len);
+
+/**
+ * Combines the CRC32C of two consecutive pieces of data.
+ *
+ * @param crc_a The CRC of the first piece.
+ * @param crc_b The CRC of the second piece.
+ * @param len_b The length of the second piece.
+ *
+ * @return The CRC of the first piece followed by the second.
+ */
+uint32_t tar_crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b);
+
+/**
+ * Computes the 64-bit xxHash of a buffer.
+ *
+ * @param buf The data.
+ * @param len Its length.
+ * @param seed The seed, tar_digest_all uses 0.
+ *
+ * @return The hash.
+ */
+uint64_t tar_xxh64(const void *buf, size_t len, uint64_t seed);
+
+/**
+ * Computes a digest of the data of every regular file of an archive.
+ *
+ * The archive is indexed and the members are shared among a pool of threads that read
+ * them with pread at their data offset. With TAR_DIGEST_CRC32C, members larger than
+ * TAR_DIGEST_CHUNK are split in chunks digested in parallel and combined afterwards;
+ * xxHash cannot be combined, so each member is digested by a single thread.
+ *
+ * Digests are reported from the calling thread, in archive order, once all are known.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param algo TAR_DIGEST_CRC32C or TAR_DIGEST_XXH64.
+ * @param nthreads Number of threads, 0 uses one per online CPU.
+ * @param callback Called for every regular file.
+ * @param arg Passed to callback.
+ *
+ * @return The number of digests reported, or -1 on error (errno is set).
+ */
+ssize_t tar_digest_all(int tar_fd, int algo, unsigned int nthreads, tar_digest_cb callback, void *arg);
+
+/**
+ * Computes the digests of an archive like tar_digest_all and keeps them in memory.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param algo TAR_DIGEST_CRC32C or TAR_DIGEST_XXH64.
+ * @param nthreads Number of threads, 0 uses one per online CPU.
+ *
+ * @return The digests, or NULL on error (errno is set).
+ */
+tar_digests_t *tar_digests_build(int tar_fd, int algo, unsigned int nthreads);
+
+/**
+ * Releases digests returned by tar_digests_build or tar_digests_load.
+ *
+ * @param digests The digests, may be NULL.
+ */
+void tar_digests_free(tar_digests_t *digests);
+
+/**
+ * Finds the digest of a member.
+ *
+ * @param digests The digests.
+ * @param data_offset The offset of the member data, as given by the index.
+ *
+ * @return The record, or NULL if the member is not a regular file of the archive.
+ */
+const tar_digest_record_t *tar_digests_find(const tar_digests_t *digests, uint64_t data_offset);
+
+/**
+ * Writes digests to a sidecar file so they can be reused without rereading the archive.
+ *
+ * @param digests The digests.
+ * @param out_fd A file descriptor opened for writing.
+ *
+ * @return 0 on success, -1 on write error.
+ */
+int tar_digests_save(const tar_digests_t *digests, int out_fd);
+
+/**
+ * Reads digests written by tar_digests_save.
+ *
+ * @param in_fd A file descriptor opened for reading, positioned at the saved digests.
+ * @param tar_fd The archive the digests are meant for, or -1 to skip the check.
+ *
+ * @return The digests, or NULL if they cannot be read or if they were computed from a
+ *         different version of the archive (errno is ESTALE).
+ */
+tar_digests_t *tar_digests_load(int in_fd, int tar_fd);
+
+#endif
@@ -0,0 +1,443 @@
+#include <errno.h>
+#include <string.h>
+#include "tar_fcindex.h"
+
+/* An entry collected by the header scan, before sorting and encoding */
+struct pending
+{
+    char *name;
+    char *link;
+    tar_fc_entry_t entry;
+};
+
+/* Sequential decoder over the front-coded names */
+struct cursor
+{
+    const tar_fcindex_t *index;
+    size_t i;                     /* number of the entry held in name */
+    size_t pos;                   /* offset of the next encoded name */
+    size_t len;
+    char name[MAX_PATH_SIZE + 1];
+};
+
+static size_t put_varint(uint8_t *out, size_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+static size_t get_varint(const uint8_t *in, size_t *pos) {
+    size_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t byte = in[(*pos)++];
+        value |= (size_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+}
+
+/* Orders names like strcmp does for NUL-free strings */
+static int compare_key(const char *a, size_t a_len, const char *b, size_t b_len) {
+    int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (cmp != 0) return cmp;
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+static int compare_pending(const void *a, const void *b) {
+    const struct pending *pa = a, *pb = b;
+    int cmp = strcmp(pa->name, pb->name);
+    if (cmp != 0) return cmp;
+    return (pa->entry.ordinal > pb->entry.ordinal) - (pa->entry.ordinal < pb->entry.ordinal);
+}
+
+static void cursor_decode(struct cursor *c) {
+    const uint8_t *names = c->index->names;
+    if (c->i % TAR_FC_BLOCK == 0) {
+        c->len = get_varint(names, &c->pos);
+        memcpy(c->name, names + c->pos, c->len);
+        c->pos += c->len;
+    } else {
+        size_t shared = get_varint(names, &c->pos);
+        size_t suffix = get_varint(names, &c->pos);
+        memcpy(c->name + shared, names + c->pos, suffix);
+        c->pos += suffix;
+        c->len = shared + suffix;
+    }
+    c->name[c->len] = '\0';
+}
+
+static void cursor_start(struct cursor *c, const tar_fcindex_t *index, size_t block) {
+    c->index = index;
+    c->i = block * TAR_FC_BLOCK;
+    c->pos = index->blocks[block];
+    cursor_decode(c);
+}
+
+static int cursor_next(struct cursor *c) {
+    if (c->i + 1 >= c->index->count) return 0;
+    c->i++;
+    cursor_decode(c); // blocks are contiguous, the next name starts where this one ended
+    return 1;
+}
+
+/* Returns the last block whose first name is <= key, or -1 if key sorts before every name */
+static long find_block(const tar_fcindex_t *index, const char *key, size_t key_len) {
+    long lo = 0, hi = (long)index->nblocks - 1, found = -1;
+    while (lo <= hi) {
+        long mid = lo + (hi - lo) / 2;
+        size_t pos = index->blocks[mid];
+        size_t head_len = get_varint(index->names, &pos);
+        if (compare_key((const char *)index->names + pos, head_len, key, key_len) <= 0) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return found;
+}
+
+static int encode(tar_fcindex_t *index, struct pending *sorted, size_t count) {
+    index->entries = malloc((count ? count : 1) * sizeof(tar_fc_entry_t));
+    index->nblocks = (count + TAR_FC_BLOCK - 1) / TAR_FC_BLOCK;
+    index->blocks = malloc((index->nblocks ? index->nblocks : 1) * sizeof(uint64_t));
+    size_t names_capacity = 0, links_capacity = 0;
+    for (size_t i = 0; i < count; ++i) {
+        names_capacity += strlen(sorted[i].name) + 2 * sizeof(size_t);
+        if (sorted[i].link) links_capacity += strlen(sorted[i].link) + 1;
+    }
+    index->names = malloc(names_capacity ? names_capacity : 1);
+    index->links = malloc(links_capacity ? links_capacity : 1);
+    if (!index->entries || !index->blocks || !index->names || !index->links) return -1;
+
+    const char *previous = "";
+    for (size_t i = 0; i < count; ++i) {
+        const char *name = sorted[i].name;
+        size_t len = strlen(name);
+        if (i % TAR_FC_BLOCK == 0) {
+            index->blocks[i / TAR_FC_BLOCK] = index->names_len;
+            index->names_len += put_varint(index->names + index->names_len, len);
+            memcpy(index->names + index->names_len, name, len);
+            index->names_len += len;
+        } else {
+            size_t shared = 0;
+            while (shared < len && name[shared] == previous[shared]) shared++;
+            index->names_len += put_varint(index->names + index->names_len, shared);
+            index->names_len += put_varint(index->names + index->names_len, len - shared);
+            memcpy(index->names + index->names_len, name + shared, len - shared);
+            index->names_len += len - shared;
+        }
+        previous = name;
+
+        index->entries[i] = sorted[i].entry;
+        if (sorted[i].link) {
+            size_t link_len = strlen(sorted[i].link) + 1;
+            index->entries[i].link = (uint32_t)index->links_len;
+            memcpy(index->links + index->links_len, sorted[i].link, link_len);
+            index->links_len += link_len;
+        }
+    }
+    index->count = count;
+    // The pools were sized for the worst case, give back what front coding saved
+    uint8_t *names = realloc(index->names, index->names_len ? index->names_len : 1);
+    if (names != NULL) index->names = names;
+    return 0;
+}
+
+/**
+ * Builds a front-coded index of every entry of an archive in a single header scan.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ *
+ * @return The index, or NULL on error.
+ */
+tar_fcindex_t *tar_fcindex_build(int tar_fd) {
+    size_t count = 0, capacity = 0;
+    struct pending *pending = NULL;
+    int failed = 0;
+
+    tar_advise(tar_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    off_t position = 0;
+    tar_header_t header;
+    while (!failed && pread(tar_fd, &header, sizeof(header), position) == sizeof(header)) {
+        if (tar_is_zero_block(&header)) {
+            position += BLOCKSIZE;
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            struct pending *grown = capacity <= UINT32_MAX ? realloc(pending, capacity * sizeof(*pending)) : NULL;
+            if (grown == NULL) {
+                failed = 1;
+                break;
+            }
+            pending = grown;
+        }
+        struct pending *p = &pending[count];
+        p->name = strndup(header.name, MAX_PATH_SIZE);
+        p->link = header.typeflag == SYMTYPE || header.typeflag == LNKTYPE ? strndup(header.linkname, MAX_PATH_SIZE) : NULL;
+        memset(&p->entry, 0, sizeof(p->entry));
+        p->entry.size = TAR_INT(header.size);
+        p->entry.mtime = TAR_INT(header.mtime);
+        p->entry.mode = (uint32_t)TAR_INT(header.mode);
+        p->entry.typeflag = header.typeflag;
+        p->entry.ordinal = (uint32_t)count;
+        p->entry.link = TAR_FC_NO_LINK;
+        p->entry.data_offset = position + BLOCKSIZE;
+        count++;
+        if (p->name == NULL || ((header.typeflag == SYMTYPE || header.typeflag == LNKTYPE) && p->link == NULL)) failed = 1;
+        if (p->entry.size < 0) {
+            // Malformed header: skipping its data would move the scan backwards
+            errno = EINVAL;
+            failed = 1;
+            break;
+        }
+        position += BLOCKSIZE + ((p->entry.size + BLOCKSIZE - 1) / BLOCKSIZE) * BLOCKSIZE;
+    }
+    tar_advise(tar_fd, 0, 0, POSIX_FADV_NORMAL);
+
+    tar_fcindex_t *index = NULL;
+    if (!failed) {
+        qsort(pending, count, sizeof(*pending), compare_pending);
+        // Keep only the first entry of each name, as get_header_type would find it
+        size_t kept = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (kept > 0 && strcmp(pending[kept - 1].name, pending[i].name) == 0) {
+                free(pending[i].name);
+                free(pending[i].link);
+                continue;
+            }
+            pending[kept++] = pending[i];
+        }
+        count = kept;
+        index = calloc(1, sizeof(tar_fcindex_t));
+        if (index != NULL && encode(index, pending, count) == -1) {
+            tar_fcindex_free(index);
+            index = NULL;
+        }
+    }
+    for (size_t i = 0; i < count; ++i) {
+        free(pending[i].name);
+        free(pending[i].link);
+    }
+    free(pending);
+    return index;
+}
+
+/**
+ * Releases an index returned by tar_fcindex_build.
+ *
+ * @param index The index, may be NULL.
+ */
+void tar_fcindex_free(tar_fcindex_t *index) {
+    if (index == NULL) return;
+    free(index->entries);
+    free(index->names);
+    free(index->blocks);
+    free(index->links);
+    free(index);
+}
+
+/**
+ * Returns the number of bytes of memory held by an index.
+ *
+ * @param index The index.
+ *
+ * @return The size of all its arrays and pools.
+ */
+size_t tar_fcindex_memory(const tar_fcindex_t *index) {
+    return sizeof(*index) + index->count * sizeof(tar_fc_entry_t) + index->names_len
+           + index->nblocks * sizeof(uint64_t) + index->links_len;
+}
+
+/**
+ * Looks a path up in O(log n).
+ *
+ * @param index The index.
+ * @param path A path to an entry in the archive.
+ *
+ * @return The entry, or NULL if no entry at the given path exists in the archive.
+ */
+const tar_fc_entry_t *tar_fcindex_lookup(const tar_fcindex_t *index, const char *path) {
+    size_t key_len = strnlen(path, MAX_PATH_SIZE);
+    long block = find_block(index, path, key_len);
+    if (block < 0) return NULL;
+    struct cursor c;
+    cursor_start(&c, index, (size_t)block);
+    do {
+        int cmp = compare_key(c.name, c.len, path, key_len);
+        if (cmp == 0) return &index->entries[c.i];
+        if (cmp > 0) break;
+    } while ((c.i + 1) % TAR_FC_BLOCK != 0 && cursor_next(&c));
+    return NULL;
+}
+
+/**
+ * Returns the link target of an entry.
+ *
+ * @param index The index.
+ * @param entry An entry of the index.
+ *
+ * @return The NUL-terminated target, or NULL if the entry is not a link.
+ */
+const char *tar_fcindex_linkname(const tar_fcindex_t *index, const tar_fc_entry_t *entry) {
+    return entry->link == TAR_FC_NO_LINK ? NULL : index->links + entry->link;
+}
+
+/**
+ * Looks a path up, following symlinks and hard links, like tar_index_resolve.
+ *
+ * @param index The index.
+ * @param path A path to an entry in the archive.
+ *
+ * @return The final entry, or NULL if it cannot be resolved.
+ */
+const tar_fc_entry_t *tar_fcindex_resolve(const tar_fcindex_t *index, const char *path) {
+    const tar_fc_entry_t *entry = tar_fcindex_lookup(index, path);
+    for (int hops = 0; entry != NULL && (entry->typeflag == SYMTYPE || entry->typeflag == LNKTYPE); ++hops) {
+        if (hops == TAR_MAX_LINKS) return NULL;
+        const char *target = tar_fcindex_linkname(index, entry);
+        while (strncmp(target, "./", 2) == 0) target += 2;
+        entry = tar_fcindex_lookup(index, target);
+        size_t len = strlen(target);
+        if (entry == NULL && len > 0 && len < MAX_PATH_SIZE && target[len - 1] != '/') {
+            char dir[MAX_PATH_SIZE + 1];
+            memcpy(dir, target, len);
+            dir[len] = '/';
+            dir[len + 1] = '\0';
+            entry = tar_fcindex_lookup(index, dir);
+        }
+    }
+    return entry;
+}
+
+/**
+ * Decodes the name of an entry.
+ *
+ * @param index The index.
+ * @param entry An entry of the index.
+ * @param name Out argument, a buffer of at least MAX_PATH_SIZE + 1 bytes.
+ */
+void tar_fcindex_name(const tar_fcindex_t *index, const tar_fc_entry_t *entry, char *name) {
+    size_t i = (size_t)(entry - index->entries);
+    struct cursor c;
+    cursor_start(&c, index, i / TAR_FC_BLOCK);
+    while (c.i < i) cursor_next(&c);
+    memcpy(name, c.name, c.len + 1);
+}
+
+/**
+ * Visits, in name order, every entry whose name starts with a prefix.
+ *
+ * @param index The index.
+ * @param prefix The prefix, "" visits every entry.
+ * @param visit Called for each entry.
+ * @param arg Passed to visit.
+ *
+ * @return The number of entries visited.
+ */
+size_t tar_fcindex_foreach_prefix(const tar_fcindex_t *index, const char *prefix, tar_fc_visit_t visit, void *arg) {
+    if (index->count == 0) return 0;
+    size_t prefix_len = strnlen(prefix, MAX_PATH_SIZE);
+    long block = find_block(index, prefix, prefix_len);
+    struct cursor c;
+    cursor_start(&c, index, block < 0 ? 0 : (size_t)block);
+    // Skip the names of the block that sort before the prefix
+    while (compare_key(c.name, c.len, prefix, prefix_len) < 0) {
+        if (!cursor_next(&c)) return 0;
+    }
+    size_t visited = 0;
+    do {
+        if (c.len < prefix_len || memcmp(c.name, prefix, prefix_len) != 0) break;
+        visited++;
+        if (visit(c.name, &index->entries[c.i], arg) != 0) break;
+    } while (cursor_next(&c));
+    return visited;
+}
+
+struct child
+{
+    uint32_t ordinal;
+    char name[MAX_PATH_SIZE + 1];
+};
+
+struct children
+{
+    size_t prefix_len;
+    size_t count, capacity;
+    struct child *items;
+    int failed;                   /* set when items could not grow */
+};
+
+static int collect_child(const char *name, const tar_fc_entry_t *entry, void *arg) {
+    struct children *children = arg;
+    const char *rest = name + children->prefix_len;
+    if (*rest == '\0') return 0; // the directory itself
+    const char *slash = strchr(rest, '/');
+    if (slash != NULL && slash[1] != '\0') return 0; // deeper than one level
+    if (children->count == children->capacity) {
+        size_t capacity = children->capacity ? 2 * children->capacity : 16;
+        struct child *grown = realloc(children->items, capacity * sizeof(struct child));
+        if (grown == NULL) {
+            children->failed = 1;
+            return 1;
+        }
+        children->items = grown;
+        children->capacity = capacity;
+    }
+    struct child *child = &children->items[children->count++];
+    child->ordinal = entry->ordinal;
+    strcpy(child->name, name);
+    return 0;
+}
+
+static int compare_ordinal(const void *a, const void *b) {
+    const struct child *ca = a, *cb = b;
+    return (ca->ordinal > cb->ordinal) - (ca->ordinal < cb->ordinal);
+}
+
+/**
+ * Lists the entries at a given path, with the semantics of list().
+ *
+ * @param index The index.
+ * @param path A path to a directory, or to a symlink to a directory.
+ * @param entries An array of char arrays, each one is long enough to contain a tar entry path.
+ * @param no_entries An in-out argument, the capacity of entries then the number of entries listed.
+ *
+ * @return zero if no directory at the given path exists in the archive,
+ *         -1 if memory runs out while collecting the entries (errno is ENOMEM),
+ *         any other value otherwise.
+ */
+int tar_fcindex_list(const tar_fcindex_t *index, const char *path, char **entries, size_t *no_entries) {
+    size_t capacity = *no_entries;
+    *no_entries = 0;
+    const tar_fc_entry_t *dir = tar_fcindex_resolve(index, path);
+    if (dir == NULL || dir->typeflag != DIRTYPE) return 0;
+
+    char prefix[MAX_PATH_SIZE + 2];
+    tar_fcindex_name(index, dir, prefix);
+    size_t prefix_len = strlen(prefix);
+    if (prefix_len == 0 || prefix[prefix_len - 1] != '/') {
+        prefix[prefix_len++] = '/';
+        prefix[prefix_len] = '\0';
+    }
+
+    // The children are contiguous in name order, list() wants them in archive order
+    struct children children = {prefix_len, 0, 0, NULL, 0};
+    tar_fcindex_foreach_prefix(index, prefix, collect_child, &children);
+    if (children.failed) {
+        // A partial listing would look complete to the caller
+        free(children.items);
+        errno = ENOMEM;
+        return -1;
+    }
+    qsort(children.items, children.count, sizeof(struct child), compare_ordinal);
+    size_t listed = children.count < capacity ? children.count : capacity;
+    for (size_t i = 0; i < listed; ++i) strcpy(entries[i], children.items[i].name);
+    free(children.items);
+    *no_entries = listed;
+    return 1;
+}
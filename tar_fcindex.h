@@ -0,0 +1,152 @@
+#ifndef TAR_FCINDEX_H
+#define TAR_FCINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "lib_tar.h"
+
+/* Number of names per front-coded block: the first one is stored in full */
+#define TAR_FC_BLOCK 16
+/* Marks an entry without link target */
+#define TAR_FC_NO_LINK UINT32_MAX
+
+/*
+ * A memory-lean alternative to tar_index for archives with millions of entries.
+ *
+ * Names are sorted and front coded: inside a block of TAR_FC_BLOCK names, each name is
+ * stored as the length of the prefix it shares with the previous one plus the remaining
+ * suffix. A directory holding the offset of each block allows a binary search on the
+ * block heads, then at most one block is decoded. Lookups cost O(log n) and names under
+ * a common prefix are contiguous, so prefix queries need no extra structure.
+ */
+
+typedef struct tar_fc_entry
+{
+    int64_t data_offset;          /* offset of the first data byte in the archive */
+    int64_t size;
+    int64_t mtime;
+    uint32_t mode;
+    uint32_t ordinal;             /* position of the header in the archive */
+    uint32_t link;                /* offset of the link target in the link pool, or TAR_FC_NO_LINK */
+    char typeflag;
+} tar_fc_entry_t;
+
+typedef struct tar_fcindex
+{
+    size_t count;                 /* number of distinct names */
+    tar_fc_entry_t *entries;      /* in name order */
+    uint8_t *names;               /* front-coded blocks */
+    size_t names_len;
+    uint64_t *blocks;             /* offset of each block in names */
+    size_t nblocks;
+    char *links;                  /* NUL-terminated link targets */
+    size_t links_len;
+} tar_fcindex_t;
+
+/**
+ * Callback of tar_fcindex_foreach_prefix.
+ *
+ * @param name The NUL-terminated name of the entry, only valid during the call.
+ * @param entry The entry.
+ * @param arg The argument given to tar_fcindex_foreach_prefix.
+ *
+ * @return zero to continue, any other value to stop the iteration.
+ */
+typedef int (*tar_fc_visit_t)(const char *name, const tar_fc_entry_t *entry, void *arg);
+
+/**
+ * Builds a front-coded index of every entry of an archive in a single header scan.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ *
+ * @return The index, or NULL on error.
+ *
+ * Note: When a path appears several times, the first entry wins, as with get_header_type.
+ */
+tar_fcindex_t *tar_fcindex_build(int tar_fd);
+
+/**
+ * Releases an index returned by tar_fcindex_build.
+ *
+ * @param index The index, may be NULL.
+ */
+void tar_fcindex_free(tar_fcindex_t *index);
+
+/**
+ * Returns the number of bytes of memory held by an index.
+ *
+ * @param index The index.
+ *
+ * @return The size of all its arrays and pools.
+ */
+size_t tar_fcindex_memory(const tar_fcindex_t *index);
+
+/**
+ * Looks a path up in O(log n).
+ *
+ * @param index The index.
+ * @param path A path to an entry in the archive.
+ *
+ * @return The entry, or NULL if no entry at the given path exists in the archive.
+ */
+const tar_fc_entry_t *tar_fcindex_lookup(const tar_fcindex_t *index, const char *path);
+
+/**
+ * Looks a path up, following symlinks and hard links, like tar_index_resolve.
+ *
+ * @param index The index.
+ * @param path A path to an entry in the archive.
+ *
+ * @return The final entry, or NULL if it cannot be resolved.
+ */
+const tar_fc_entry_t *tar_fcindex_resolve(const tar_fcindex_t *index, const char *path);
+
+/**
+ * Returns the link target of an entry.
+ *
+ * @param index The index.
+ * @param entry An entry of the index.
+ *
+ * @return The NUL-terminated target, or NULL if the entry is not a link.
+ */
+const char *tar_fcindex_linkname(const tar_fcindex_t *index, const tar_fc_entry_t *entry);
+
+/**
+ * Decodes the name of an entry.
+ *
+ * @param index The index.
+ * @param entry An entry of the index.
+ * @param name Out argument, a buffer of at least MAX_PATH_SIZE + 1 bytes.
+ */
+void tar_fcindex_name(const tar_fcindex_t *index, const tar_fc_entry_t *entry, char *name);
+
+/**
+ * Visits, in name order, every entry whose name starts with a prefix.
+ *
+ * @param index The index.
+ * @param prefix The prefix, "" visits every entry.
+ * @param visit Called for each entry.
+ * @param arg Passed to visit.
+ *
+ * @return The number of entries visited.
+ */
+size_t tar_fcindex_foreach_prefix(const tar_fcindex_t *index, const char *prefix, tar_fc_visit_t visit, void *arg);
+
+/**
+ * Lists the entries at a given path, with the semantics of list().
+ *
+ * @param index The index.
+ * @param path A path to a directory, or to a symlink to a directory.
+ * @param entries An array of char arrays, each one is long enough to contain a tar entry path.
+ * @param no_entries An in-out argument.
+ *                   The caller set it to the number of entries in `entries`.
+ *                   The callee set it to the number of entries listed, in archive order.
+ *
+ * @return zero if no directory at the given path exists in the archive,
+ *         -1 if memory runs out while collecting the entries (errno is ENOMEM),
+ *         any other value otherwise.
+ */
+int tar_fcindex_list(const tar_fcindex_t *index, const char *path, char **entries, size_t *no_entries);
+
+#endif
@@ -0,0 +1,293 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "tar_cache.h"
+#include "tar_index.h"
+
+static const tar_entry_t *find(const tar_index_t *index, const char *path) {
+    if (index->nslots == 0) return NULL;
+    size_t mask = index->nslots - 1;
+    for (size_t slot = tar_hash_path(path) & mask; index->slots[slot] != 0; slot = (slot + 1) & mask) {
+        const tar_entry_t *entry = &index->entries[index->slots[slot] - 1];
+        if (strncmp(entry->name, path, MAX_PATH_SIZE) == 0) return entry;
+    }
+    return NULL;
+}
+
+static int fill_slots(tar_index_t *index) {
+    size_t nslots = 16;
+    while (nslots < 2 * index->count) nslots *= 2;
+    index->slots = calloc(nslots, sizeof(uint32_t));
+    if (index->slots == NULL) return -1;
+    index->nslots = nslots;
+    for (size_t i = 0; i < index->count; ++i) {
+        size_t slot = tar_hash_path(index->entries[i].name) & (nslots - 1);
+        int duplicate = 0;
+        while (index->slots[slot] != 0) {
+            if (strcmp(index->entries[index->slots[slot] - 1].name, index->entries[i].name) == 0) {
+                duplicate = 1; // the first entry with this name wins, as in get_header_type
+                break;
+            }
+            slot = (slot + 1) & (nslots - 1);
+        }
+        if (!duplicate) index->slots[slot] = (uint32_t)(i + 1);
+    }
+    return 0;
+}
+
+/* Reads every header of the archive with pread, see tar_index_build */
+static tar_index_t *scan_archive(int tar_fd) {
+    struct stat st;
+    if (fstat(tar_fd, &st) == -1) return NULL;
+    tar_index_t *index = calloc(1, sizeof(tar_index_t));
+    if (index == NULL) return NULL;
+    index->archive_dev = st.st_dev;
+    index->archive_ino = st.st_ino;
+    index->archive_size = st.st_size;
+    index->archive_mtime = st.st_mtime;
+
+    size_t capacity = 0;
+    off_t position = 0;
+    tar_header_t header;
+    while (pread(tar_fd, &header, sizeof(header), position) == sizeof(header)) {
+        if (tar_is_zero_block(&header)) {
+            position += BLOCKSIZE;
+            continue;
+        }
+        if (index->count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            tar_entry_t *grown = capacity <= UINT32_MAX ? realloc(index->entries, capacity * sizeof(tar_entry_t)) : NULL;
+            if (grown == NULL) {
+                tar_index_free(index);
+                return NULL;
+            }
+            index->entries = grown;
+        }
+        tar_entry_t *entry = &index->entries[index->count++];
+        memcpy(entry->name, header.name, MAX_PATH_SIZE);
+        entry->name[MAX_PATH_SIZE] = '\0';
+        memcpy(entry->linkname, header.linkname, MAX_PATH_SIZE);
+        entry->linkname[MAX_PATH_SIZE] = '\0';
+        entry->typeflag = header.typeflag;
+        entry->mode = (uint32_t)TAR_INT(header.mode);
+        entry->mtime = TAR_INT(header.mtime);
+        entry->size = TAR_INT(header.size);
+        if (entry->size < 0) {
+            // Malformed header: skipping its data would move the scan backwards
+            tar_index_free(index);
+            errno = EINVAL;
+            return NULL;
+        }
+        entry->header_offset = position;
+        entry->data_offset = position + BLOCKSIZE;
+        position += BLOCKSIZE + ((entry->size + BLOCKSIZE - 1) / BLOCKSIZE) * BLOCKSIZE;
+    }
+
+    if (fill_slots(index) == -1) {
+        tar_index_free(index);
+        return NULL;
+    }
+    return index;
+}
+
+/**
+ * Builds an index of every entry of an archive in a single header scan.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ *
+ * @return The index, or NULL on error.
+ */
+tar_index_t *tar_index_build(int tar_fd) {
+    tar_advise(tar_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    tar_index_t *index = scan_archive(tar_fd);
+    tar_advise(tar_fd, 0, 0, POSIX_FADV_NORMAL);
+    return index;
+}
+
+/**
+ * Releases an index returned by tar_index_build.
+ *
+ * @param index The index, may be NULL.
+ */
+void tar_index_free(tar_index_t *index) {
+    if (index == NULL) return;
+    free(index->entries);
+    free(index->slots);
+    free(index);
+}
+
+/**
+ * Checks whether the archive changed since the index was built.
+ *
+ * @param index The index.
+ * @param tar_fd A file descriptor on the archive.
+ *
+ * @return zero if the index still describes the archive, any other value otherwise.
+ */
+int tar_index_is_stale(const tar_index_t *index, int tar_fd) {
+    struct stat st;
+    if (fstat(tar_fd, &st) == -1) return 1;
+    return st.st_dev != index->archive_dev || st.st_ino != index->archive_ino
+           || st.st_size != index->archive_size || st.st_mtime != index->archive_mtime;
+}
+
+/**
+ * Looks a path up in O(1).
+ *
+ * @param index The index.
+ * @param path A path to an entry in the archive.
+ *
+ * @return The entry, or NULL if no entry at the given path exists in the archive.
+ */
+const tar_entry_t *tar_index_lookup(const tar_index_t *index, const char *path) {
+    return find(index, path);
+}
+
+/**
+ * Looks a path up, following symlinks (and hard links) to their target.
+ *
+ * @param index The index.
+ * @param path A path to an entry in the archive.
+ *
+ * @return The final entry, or NULL if it cannot be resolved.
+ */
+const tar_entry_t *tar_index_resolve(const tar_index_t *index, const char *path) {
+    const tar_entry_t *entry = find(index, path);
+    for (int hops = 0; entry != NULL && (entry->typeflag == SYMTYPE || entry->typeflag == LNKTYPE); ++hops) {
+        if (hops == TAR_INDEX_MAX_LINKS) return NULL;
+        const char *target = entry->linkname;
+        while (strncmp(target, "./", 2) == 0) target += 2;
+        entry = find(index, target);
+        size_t len = strlen(target);
+        if (entry == NULL && len > 0 && len < MAX_PATH_SIZE && target[len - 1] != '/') {
+            // Links to directories are usually written without the trailing slash of the entry
+            char dir[MAX_PATH_SIZE + 1];
+            memcpy(dir, target, len);
+            dir[len] = '/';
+            dir[len + 1] = '\0';
+            entry = find(index, dir);
+        }
+    }
+    return entry;
+}
+
+/**
+ * Returns the type of an entry, with the same values as get_header_type.
+ *
+ * @param entry The entry.
+ *
+ * @return 1 file, 2 directory, 3 symlink, 4 hard link.
+ */
+int tar_entry_type(const tar_entry_t *entry) {
+    switch (entry->typeflag) {
+        case DIRTYPE:
+            return 2;
+        case SYMTYPE:
+            return 3;
+        case LNKTYPE:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+/**
+ * Collects the entries directly inside a directory.
+ *
+ * @param index The index.
+ * @param dir A directory entry of the index.
+ * @param children Out argument, filled with up to `max` entries in archive order.
+ * @param max The capacity of children.
+ *
+ * @return The total number of entries in the directory, which may exceed max.
+ */
+size_t tar_index_children(const tar_index_t *index, const tar_entry_t *dir, const tar_entry_t **children, size_t max) {
+    size_t prefix_len = strlen(dir->name);
+    int has_slash = prefix_len > 0 && dir->name[prefix_len - 1] == '/';
+    size_t found = 0;
+    for (size_t i = 0; i < index->count; ++i) {
+        const tar_entry_t *entry = &index->entries[i];
+        if (strncmp(entry->name, dir->name, prefix_len) != 0) continue;
+        const char *rest = entry->name + prefix_len;
+        if (!has_slash) {
+            if (*rest != '/') continue;
+            rest++;
+        }
+        if (*rest == '\0') continue; // the directory itself
+        const char *slash = strchr(rest, '/');
+        if (slash != NULL && slash[1] != '\0') continue; // deeper than one level
+        if (find(index, entry->name) != entry) continue; // shadowed duplicate
+        if (found < max) children[found] = entry;
+        found++;
+    }
+    return found;
+}
+
+/**
+ * Lists the entries at a given path, with the semantics of list().
+ *
+ * @param index The index.
+ * @param path A path to a directory, or to a symlink to a directory.
+ * @param entries An array of char arrays, each one is long enough to contain a tar entry path.
+ * @param no_entries An in-out argument, the capacity of entries then the number of entries listed.
+ *
+ * @return zero if no directory at the given path exists in the archive,
+ *         any other value otherwise.
+ */
+int tar_index_list(const tar_index_t *index, const char *path, char **entries, size_t *no_entries) {
+    size_t capacity = *no_entries;
+    *no_entries = 0;
+    const tar_entry_t *dir = tar_index_resolve(index, path);
+    if (dir == NULL || dir->typeflag != DIRTYPE) return 0;
+
+    const tar_entry_t **children = capacity ? malloc(capacity * sizeof(*children)) : NULL;
+    if (capacity && children == NULL) return 0;
+    size_t total = tar_index_children(index, dir, children, capacity);
+    size_t listed = total < capacity ? total : capacity;
+    for (size_t i = 0; i < listed; ++i) strcpy(entries[i], children[i]->name);
+    free(children);
+    *no_entries = listed;
+    return 1;
+}
+
+/**
+ * Reads a file at a given path, with the semantics of read_file().
+ *
+ * @param index The index.
+ * @param tar_fd A file descriptor on the indexed archive.
+ * @param path A path to an entry in the archive, symlinks are followed.
+ * @param offset An offset in the file from which to start reading from.
+ * @param dest A destination buffer.
+ * @param len An in-out argument, the size of dest then the number of bytes written to it.
+ *
+ * @return -1 if no entry at the given path exists in the archive or the entry is not a file,
+ *         -2 if the offset is outside the file total length,
+ *         zero if the file was read in its entirety into the destination buffer,
+ *         a positive value representing the remaining bytes left to be read otherwise.
+ */
+ssize_t tar_index_read(const tar_index_t *index, int tar_fd, const char *path, size_t offset, uint8_t *dest, size_t *len) {
+    const tar_entry_t *entry = tar_index_resolve(index, path);
+    if (entry == NULL || tar_entry_type(entry) != 1) {
+        *len = 0;
+        return -1;
+    }
+    if (offset >= (uint64_t)entry->size) { // unsigned, as in read_file, so huge offsets do not wrap
+        *len = 0;
+        return -2;
+    }
+    size_t left = (size_t)((uint64_t)entry->size - offset);
+    size_t to_read = left < *len ? left : *len;
+    size_t done = 0;
+    while (done < to_read) {
+        ssize_t n = tar_cached_pread(tar_fd, dest + done, to_read - done, entry->data_offset + (off_t)(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    if (done == 0 && to_read > 0) {
+        *len = 0;
+        return -1;
+    }
+    *len = done;
+    return (ssize_t)(left - done);
+}
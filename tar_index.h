@@ -0,0 +1,144 @@
+#ifndef TAR_INDEX_H
+#define TAR_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "lib_tar.h"
+
+/* Maximum number of symlinks followed when resolving a path */
+#define TAR_INDEX_MAX_LINKS TAR_MAX_LINKS
+
+typedef struct tar_entry
+{
+    char name[MAX_PATH_SIZE + 1];     /* NUL-terminated copy of the name field */
+    char linkname[MAX_PATH_SIZE + 1]; /* NUL-terminated copy of the linkname field */
+    char typeflag;
+    uint32_t mode;
+    int64_t mtime;
+    int64_t size;
+    off_t header_offset;              /* offset of the header block in the archive */
+    off_t data_offset;                /* offset of the first data byte */
+} tar_entry_t;
+
+typedef struct tar_index
+{
+    tar_entry_t *entries;             /* in archive order */
+    size_t count;
+    uint32_t *slots;                  /* open addressing table of entry number + 1, 0 when free */
+    size_t nslots;                    /* power of two */
+    uint64_t archive_dev;             /* identity of the indexed archive */
+    uint64_t archive_ino;
+    int64_t archive_size;
+    int64_t archive_mtime;
+} tar_index_t;
+
+/**
+ * Builds an index of every entry of an archive in a single header scan.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ *
+ * @return The index, or NULL on error.
+ *
+ * Note: The archive is read with pread, the file offset of tar_fd is not used. When a
+ *       path appears several times, the first entry wins, as with get_header_type.
+ */
+tar_index_t *tar_index_build(int tar_fd);
+
+/**
+ * Releases an index returned by tar_index_build.
+ *
+ * @param index The index, may be NULL.
+ */
+void tar_index_free(tar_index_t *index);
+
+/**
+ * Checks whether the archive changed since the index was built.
+ *
+ * @param index The index.
+ * @param tar_fd A file descriptor on the archive.
+ *
+ * @return zero if the index still describes the archive, any other value otherwise.
+ */
+int tar_index_is_stale(const tar_index_t *index, int tar_fd);
+
+/**
+ * Looks a path up in O(1).
+ *
+ * @param index The index.
+ * @param path A path to an entry in the archive.
+ *
+ * @return The entry, or NULL if no entry at the given path exists in the archive.
+ */
+const tar_entry_t *tar_index_lookup(const tar_index_t *index, const char *path);
+
+/**
+ * Looks a path up, following symlinks (and hard links) to their target.
+ *
+ * Link targets are taken relative to the root of the archive, a leading "./" is ignored.
+ *
+ * @param index The index.
+ * @param path A path to an entry in the archive.
+ *
+ * @return The final entry, or NULL if the path or one of the link targets does not exist,
+ *         or if more than TAR_INDEX_MAX_LINKS links were followed.
+ */
+const tar_entry_t *tar_index_resolve(const tar_index_t *index, const char *path);
+
+/**
+ * Returns the type of an entry, with the same values as get_header_type.
+ *
+ * @param entry The entry.
+ *
+ * @return 1 file, 2 directory, 3 symlink, 4 hard link.
+ */
+int tar_entry_type(const tar_entry_t *entry);
+
+/**
+ * Collects the entries directly inside a directory.
+ *
+ * @param index The index.
+ * @param dir A directory entry of the index.
+ * @param children Out argument, filled with up to `max` entries in archive order. May be NULL if max is 0.
+ * @param max The capacity of children.
+ *
+ * @return The total number of entries in the directory, which may exceed max.
+ */
+size_t tar_index_children(const tar_index_t *index, const tar_entry_t *dir, const tar_entry_t **children, size_t max);
+
+/**
+ * Lists the entries at a given path, with the semantics of list().
+ *
+ * @param index The index.
+ * @param path A path to a directory, or to a symlink to a directory.
+ * @param entries An array of char arrays, each one is long enough to contain a tar entry path.
+ * @param no_entries An in-out argument.
+ *                   The caller set it to the number of entries in `entries`.
+ *                   The callee set it to the number of entries listed.
+ *
+ * @return zero if no directory at the given path exists in the archive,
+ *         any other value otherwise.
+ */
+int tar_index_list(const tar_index_t *index, const char *path, char **entries, size_t *no_entries);
+
+/**
+ * Reads a file at a given path, with the semantics of read_file().
+ *
+ * @param index The index.
+ * @param tar_fd A file descriptor on the indexed archive.
+ * @param path A path to an entry in the archive, symlinks are followed.
+ * @param offset An offset in the file from which to start reading from.
+ * @param dest A destination buffer.
+ * @param len An in-out argument, the size of dest then the number of bytes written to it.
+ *
+ * @return -1 if no entry at the given path exists in the archive or the entry is not a file,
+ *         -2 if the offset is outside the file total length,
+ *         zero if the file was read in its entirety into the destination buffer,
+ *         a positive value representing the remaining bytes left to be read otherwise.
+ *
+ * Note: Only pread is used, so concurrent calls on the same descriptor are safe.
+ *       Small reads go through the block cache attached to tar_fd, if any.
+ */
+ssize_t tar_index_read(const tar_index_t *index, int tar_fd, const char *path, size_t offset, uint8_t *dest, size_t *len);
+
+#endif
@@ -0,0 +1,274 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tar_overlay.h"
+
+/* Copies a path without its trailing slashes, returns its length */
+static size_t normalize(const char *path, char *out) {
+    size_t len = strnlen(path, MAX_PATH_SIZE);
+    while (len > 0 && path[len - 1] == '/') len--;
+    memcpy(out, path, len);
+    out[len] = '\0';
+    return len;
+}
+
+/*
+ * Finds the slot of a key in one of the tables. Both item types start with their path, so
+ * the table only needs the item size. Returns the matching slot, or the free one ending the
+ * probe sequence.
+ */
+static uint32_t *find_slot(uint32_t *slots, size_t nslots, const void *items, size_t item_size, const char *key) {
+    size_t mask = nslots - 1;
+    size_t slot = tar_hash_path(key) & mask;
+    while (slots[slot] != 0) {
+        const char *path = (const char *)items + (slots[slot] - 1) * item_size;
+        if (strcmp(path, key) == 0) break;
+        slot = (slot + 1) & mask;
+    }
+    return &slots[slot];
+}
+
+static const tar_overlay_entry_t *find_entry(const tar_overlay_t *overlay, const char *key) {
+    uint32_t slot = *find_slot(overlay->slots, overlay->nslots, overlay->entries, sizeof(tar_overlay_entry_t), key);
+    return slot != 0 ? &overlay->entries[slot - 1] : NULL;
+}
+
+static const struct tar_overlay_marker *find_marker(const tar_overlay_t *overlay, const char *key) {
+    uint32_t slot = *find_slot(overlay->marker_slots, overlay->nslots, overlay->markers, sizeof(struct tar_overlay_marker), key);
+    return slot != 0 ? &overlay->markers[slot - 1] : NULL;
+}
+
+/* Checks whether the upper layers merged so far hide key in the current layer */
+static int is_hidden(const tar_overlay_t *overlay, const char *key, size_t len) {
+    const struct tar_overlay_marker *marker = find_marker(overlay, key);
+    if (marker != NULL && !marker->opaque) return 1;
+    char prefix[MAX_PATH_SIZE + 1];
+    for (size_t i = 0; i < len; ++i) {
+        if (i != 0 && key[i] != '/') continue;
+        memcpy(prefix, key, i);
+        prefix[i] = '\0';
+        // A whiteout or an opaque directory above hides the whole subtree
+        if (find_marker(overlay, prefix) != NULL) return 1;
+        // So does a file or a link standing where a parent directory would be
+        const tar_overlay_entry_t *parent = i != 0 ? find_entry(overlay, prefix) : NULL;
+        if (parent != NULL && parent->entry->typeflag != DIRTYPE) return 1;
+    }
+    return 0;
+}
+
+static void add_marker(tar_overlay_t *overlay, const char *key, size_t len) {
+    const char *base = strrchr(key, '/');
+    size_t dir_len = base != NULL ? (size_t)(base - key) : 0;
+    base = base != NULL ? base + 1 : key;
+    struct tar_overlay_marker marker;
+    memset(&marker, 0, sizeof(marker));
+    if (strcmp(base, TAR_WHITEOUT_OPAQUE) == 0) {
+        memcpy(marker.path, key, dir_len);
+        marker.opaque = 1;
+    } else {
+        // ".wh.name" in "dir" hides "dir/name", a bare ".wh." names nothing and would hide all of "dir"
+        if (base[strlen(TAR_WHITEOUT_PREFIX)] == '\0') return;
+        size_t prefix_len = base - key;
+        memcpy(marker.path, key, prefix_len);
+        memcpy(marker.path + prefix_len, base + strlen(TAR_WHITEOUT_PREFIX), len - prefix_len - strlen(TAR_WHITEOUT_PREFIX));
+    }
+    uint32_t *slot = find_slot(overlay->marker_slots, overlay->nslots, overlay->markers, sizeof(marker), marker.path);
+    if (*slot != 0) {
+        // A plain whiteout of the directory hides more than an opaque one
+        overlay->markers[*slot - 1].opaque &= marker.opaque;
+        return;
+    }
+    overlay->markers[overlay->nmarkers] = marker;
+    *slot = (uint32_t)(++overlay->nmarkers);
+}
+
+static int is_whiteout(const char *key) {
+    const char *base = strrchr(key, '/');
+    base = base != NULL ? base + 1 : key;
+    return strncmp(base, TAR_WHITEOUT_PREFIX, strlen(TAR_WHITEOUT_PREFIX)) == 0;
+}
+
+/* Adds the visible entries of a layer, then records its whiteouts for the layers below */
+static void merge_layer(tar_overlay_t *overlay, size_t layer) {
+    const tar_index_t *index = overlay->layers[layer];
+    char key[MAX_PATH_SIZE + 1];
+    for (size_t i = 0; i < index->count; ++i) {
+        const tar_entry_t *entry = &index->entries[i];
+        if (tar_index_lookup(index, entry->name) != entry) continue; // shadowed duplicate
+        size_t len = normalize(entry->name, key);
+        if (len == 0 || is_whiteout(key)) continue;
+        uint32_t *slot = find_slot(overlay->slots, overlay->nslots, overlay->entries, sizeof(tar_overlay_entry_t), key);
+        if (*slot != 0 || is_hidden(overlay, key, len)) continue;
+        tar_overlay_entry_t *merged = &overlay->entries[overlay->count];
+        memcpy(merged->path, key, len + 1);
+        merged->entry = entry;
+        merged->layer = layer;
+        *slot = (uint32_t)(++overlay->count);
+    }
+    for (size_t i = 0; i < index->count; ++i) {
+        const tar_entry_t *entry = &index->entries[i];
+        size_t len = normalize(entry->name, key);
+        if (len > 0 && is_whiteout(key)) add_marker(overlay, key, len);
+    }
+}
+
+/**
+ * Builds the merged view of a stack of archives.
+ *
+ * @param fds File descriptors on the archives, from the bottom (base) layer to the top one.
+ * @param nlayers The number of archives.
+ *
+ * @return The overlay, or NULL on error.
+ */
+tar_overlay_t *tar_overlay_open(const int *fds, size_t nlayers) {
+    if (fds == NULL || nlayers == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    tar_overlay_t *overlay = calloc(1, sizeof(tar_overlay_t));
+    if (overlay == NULL) return NULL;
+    overlay->fds = malloc(nlayers * sizeof(int));
+    overlay->layers = calloc(nlayers, sizeof(tar_index_t *));
+    if (overlay->fds == NULL || overlay->layers == NULL) goto error;
+    overlay->nlayers = nlayers;
+    memcpy(overlay->fds, fds, nlayers * sizeof(int));
+
+    size_t total = 0;
+    for (size_t layer = 0; layer < nlayers; ++layer) {
+        overlay->layers[layer] = tar_index_build(fds[layer]);
+        if (overlay->layers[layer] == NULL) goto error;
+        total += overlay->layers[layer]->count;
+    }
+    size_t nslots = 16;
+    while (nslots < 2 * total) nslots *= 2;
+    overlay->nslots = nslots;
+    overlay->slots = calloc(nslots, sizeof(uint32_t));
+    overlay->marker_slots = calloc(nslots, sizeof(uint32_t));
+    overlay->entries = malloc((total ? total : 1) * sizeof(tar_overlay_entry_t));
+    overlay->markers = malloc((total ? total : 1) * sizeof(struct tar_overlay_marker));
+    if (overlay->slots == NULL || overlay->marker_slots == NULL || overlay->entries == NULL || overlay->markers == NULL) goto error;
+
+    // From the top layer down, so that the first entry of a path is the visible one
+    for (size_t layer = nlayers; layer-- > 0;) merge_layer(overlay, layer);
+    return overlay;
+
+error:
+    tar_overlay_free(overlay);
+    return NULL;
+}
+
+/**
+ * Releases an overlay returned by tar_overlay_open.
+ *
+ * @param overlay The overlay, may be NULL.
+ */
+void tar_overlay_free(tar_overlay_t *overlay) {
+    if (overlay == NULL) return;
+    for (size_t layer = 0; overlay->layers != NULL && layer < overlay->nlayers; ++layer) {
+        tar_index_free(overlay->layers[layer]);
+    }
+    free(overlay->layers);
+    free(overlay->fds);
+    free(overlay->entries);
+    free(overlay->slots);
+    free(overlay->markers);
+    free(overlay->marker_slots);
+    free(overlay);
+}
+
+/**
+ * Looks a path up in the merged view in O(1). A trailing slash is ignored.
+ *
+ * @param overlay The overlay.
+ * @param path A path to an entry.
+ *
+ * @return The visible entry, or NULL if no layer shows an entry at this path.
+ */
+const tar_overlay_entry_t *tar_overlay_lookup(const tar_overlay_t *overlay, const char *path) {
+    char key[MAX_PATH_SIZE + 1];
+    if (normalize(path, key) == 0) return NULL;
+    return find_entry(overlay, key);
+}
+
+/**
+ * Looks a path up in the merged view, following symlinks and hard links to their target.
+ *
+ * @param overlay The overlay.
+ * @param path A path to an entry.
+ *
+ * @return The final entry, or NULL if it cannot be resolved.
+ */
+const tar_overlay_entry_t *tar_overlay_resolve(const tar_overlay_t *overlay, const char *path) {
+    const tar_overlay_entry_t *merged = tar_overlay_lookup(overlay, path);
+    for (int hops = 0; merged != NULL && (merged->entry->typeflag == SYMTYPE || merged->entry->typeflag == LNKTYPE); ++hops) {
+        if (hops == TAR_MAX_LINKS) return NULL;
+        const char *target = merged->entry->linkname;
+        while (strncmp(target, "./", 2) == 0) target += 2;
+        merged = tar_overlay_lookup(overlay, target);
+    }
+    return merged;
+}
+
+/**
+ * Checks whether an entry exists in the merged view.
+ *
+ * @param overlay The overlay.
+ * @param path A path to an entry.
+ *
+ * @return zero if no entry at the given path is visible,
+ *         any other value otherwise.
+ */
+int tar_overlay_exists(const tar_overlay_t *overlay, const char *path) {
+    return tar_overlay_lookup(overlay, path) != NULL;
+}
+
+/**
+ * Lists the entries at a given path of the merged view, with the semantics of list().
+ *
+ * @param overlay The overlay.
+ * @param path A path to a directory, or to a symlink to a directory.
+ * @param entries An array of char arrays, each one is long enough to contain a tar entry path.
+ * @param no_entries An in-out argument, the capacity of entries then the number of entries listed.
+ *
+ * @return zero if no directory at the given path is visible,
+ *         any other value otherwise.
+ */
+int tar_overlay_list(const tar_overlay_t *overlay, const char *path, char **entries, size_t *no_entries) {
+    size_t capacity = *no_entries;
+    *no_entries = 0;
+    const tar_overlay_entry_t *dir = tar_overlay_resolve(overlay, path);
+    if (dir == NULL || dir->entry->typeflag != DIRTYPE) return 0;
+
+    size_t dir_len = strlen(dir->path);
+    for (size_t i = 0; i < overlay->count && *no_entries < capacity; ++i) {
+        const tar_overlay_entry_t *merged = &overlay->entries[i];
+        if (strncmp(merged->path, dir->path, dir_len) != 0 || merged->path[dir_len] != '/') continue;
+        if (strchr(merged->path + dir_len + 1, '/') != NULL) continue; // deeper than one level
+        strcpy(entries[(*no_entries)++], merged->entry->name);
+    }
+    return 1;
+}
+
+/**
+ * Reads a file of the merged view, with the semantics of read_file().
+ *
+ * @param overlay The overlay.
+ * @param path A path to an entry, symlinks are followed.
+ * @param offset An offset in the file from which to start reading from.
+ * @param dest A destination buffer.
+ * @param len An in-out argument, the size of dest then the number of bytes written to it.
+ *
+ * @return -1 if no entry at the given path is visible or the entry is not a file,
+ *         -2 if the offset is outside the file total length,
+ *         zero if the file was read in its entirety into the destination buffer,
+ *         a positive value representing the remaining bytes left to be read otherwise.
+ */
+ssize_t tar_overlay_read_file(const tar_overlay_t *overlay, const char *path, size_t offset, uint8_t *dest, size_t *len) {
+    const tar_overlay_entry_t *merged = tar_overlay_resolve(overlay, path);
+    if (merged == NULL || tar_entry_type(merged->entry) != 1) {
+        *len = 0;
+        return -1;
+    }
+    // The entry is the first of its name in its layer, the layer index finds it again
+    return tar_index_read(overlay->layers[merged->layer], overlay->fds[merged->layer], merged->entry->name, offset, dest, len);
+}
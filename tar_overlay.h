@@ -0,0 +1,136 @@
+#ifndef TAR_OVERLAY_H
+#define TAR_OVERLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "tar_index.h"
+
+/* Prefix of whiteout entries, ".wh.name" hides "name" in the layers below */
+#define TAR_WHITEOUT_PREFIX ".wh."
+/* Whiteout hiding the whole content of its directory in the layers below */
+#define TAR_WHITEOUT_OPAQUE ".wh..wh..opq"
+
+/* An entry of the merged view */
+typedef struct tar_overlay_entry
+{
+    char path[MAX_PATH_SIZE + 1];     /* name of the entry without the trailing slash of directories */
+    const tar_entry_t *entry;         /* the entry in the index of its layer */
+    size_t layer;                     /* the layer holding it, 0 is the bottom one */
+} tar_overlay_entry_t;
+
+/* A path hidden by a whiteout */
+struct tar_overlay_marker
+{
+    char path[MAX_PATH_SIZE + 1];
+    int opaque;                       /* only the content of the directory is hidden */
+};
+
+typedef struct tar_overlay
+{
+    size_t nlayers;
+    int *fds;                         /* descriptor of each layer, not owned */
+    tar_index_t **layers;             /* index of each layer */
+    tar_overlay_entry_t *entries;     /* visible entries, upper layers first */
+    size_t count;
+    uint32_t *slots;                  /* open addressing table of entry number + 1 */
+    struct tar_overlay_marker *markers;
+    size_t nmarkers;
+    uint32_t *marker_slots;           /* open addressing table of marker number + 1 */
+    size_t nslots;                    /* size of both tables, a power of two */
+} tar_overlay_t;
+
+/**
+ * Builds the merged view of a stack of archives.
+ *
+ * Every layer is indexed once. An entry of an upper layer shadows the entries with the
+ * same path below it, and a non-directory shadows everything below its path. A whiteout
+ * ".wh.name" hides "name" and its content in the lower layers, an opaque whiteout
+ * ".wh..wh..opq" hides the lower content of its directory. Whiteouts are never visible, a
+ * whiteout with an empty name (".wh.") hides nothing.
+ *
+ * @param fds File descriptors on the archives, from the bottom (base) layer to the top one.
+ *            They must stay open while the overlay is used, tar_overlay_free does not close them.
+ * @param nlayers The number of archives.
+ *
+ * @return The overlay, or NULL on error.
+ */
+tar_overlay_t *tar_overlay_open(const int *fds, size_t nlayers);
+
+/**
+ * Releases an overlay returned by tar_overlay_open.
+ *
+ * @param overlay The overlay, may be NULL.
+ */
+void tar_overlay_free(tar_overlay_t *overlay);
+
+/**
+ * Looks a path up in the merged view in O(1). A trailing slash is ignored.
+ *
+ * @param overlay The overlay.
+ * @param path A path to an entry.
+ *
+ * @return The visible entry, or NULL if no layer shows an entry at this path.
+ */
+const tar_overlay_entry_t *tar_overlay_lookup(const tar_overlay_t *overlay, const char *path);
+
+/**
+ * Looks a path up in the merged view, following symlinks and hard links to their target.
+ *
+ * Link targets are taken relative to the root of the view and may lie in another layer.
+ *
+ * @param overlay The overlay.
+ * @param path A path to an entry.
+ *
+ * @return The final entry, or NULL if the path or one of the link targets is not visible,
+ *         or if more than TAR_MAX_LINKS links were followed.
+ */
+const tar_overlay_entry_t *tar_overlay_resolve(const tar_overlay_t *overlay, const char *path);
+
+/**
+ * Checks whether an entry exists in the merged view.
+ *
+ * @param overlay The overlay.
+ * @param path A path to an entry.
+ *
+ * @return zero if no entry at the given path is visible,
+ *         any other value otherwise.
+ */
+int tar_overlay_exists(const tar_overlay_t *overlay, const char *path);
+
+/**
+ * Lists the entries at a given path of the merged view, with the semantics of list().
+ *
+ * @param overlay The overlay.
+ * @param path A path to a directory, or to a symlink to a directory.
+ * @param entries An array of char arrays, each one is long enough to contain a tar entry path.
+ * @param no_entries An in-out argument.
+ *                   The caller set it to the number of entries in `entries`.
+ *                   The callee set it to the number of entries listed.
+ *
+ * @return zero if no directory at the given path is visible,
+ *         any other value otherwise.
+ *
+ * Note: The directory content is merged from every layer that shows it.
+ */
+int tar_overlay_list(const tar_overlay_t *overlay, const char *path, char **entries, size_t *no_entries);
+
+/**
+ * Reads a file of the merged view, with the semantics of read_file().
+ *
+ * @param overlay The overlay.
+ * @param path A path to an entry, symlinks are followed.
+ * @param offset An offset in the file from which to start reading from.
+ * @param dest A destination buffer.
+ * @param len An in-out argument, the size of dest then the number of bytes written to it.
+ *
+ * @return -1 if no entry at the given path is visible or the entry is not a file,
+ *         -2 if the offset is outside the file total length,
+ *         zero if the file was read in its entirety into the destination buffer,
+ *         a positive value representing the remaining bytes left to be read otherwise.
+ *
+ * Note: The data is read with pread from the descriptor of the layer holding the file.
+ */
+ssize_t tar_overlay_read_file(const tar_overlay_t *overlay, const char *path, size_t offset, uint8_t *dest, size_t *len);
+
+#endif
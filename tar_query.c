@@ -0,0 +1,202 @@
+/**
+ * tar_query: answers a batch of queries about one archive.
+ *
+ * The archive is opened and indexed once, then each command read from standard input
+ * (or from the file given with -f) is answered in O(1), except ls which walks the index.
+ *
+ * Usage: tar_query [-f commands_file] archive
+ *
+ * Commands, one per line, and the answers written to standard output:
+ *
+ *   exists <path>                 1 or 0
+ *   type <path>                   file, dir, symlink, hardlink or none (links are not followed)
+ *   ls <path>                     <n>, then n lines holding one entry path each,
+ *                                 or -1 if the path is not a directory (symlinks are followed)
+ *   cat <path> <offset> <len>     <n> <remaining>, then n raw bytes of the file and a newline,
+ *                                 or <error> -1 with the error returned by read_file, or
+ *                                 -3 -1 if the archive is truncated before the end of the range,
+ *                                 or ? if offset or len is not a decimal number
+ *   check                         the value returned by check_archive
+ *
+ * Unknown commands and empty lines are answered with "?" so the answers stay aligned with
+ * the commands. If reading the archive fails after the header of a cat answer was written,
+ * tar_query reports the error on standard error and exits with status 1 instead of
+ * answering with fewer bytes than announced.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "lib_tar.h"
+#include "tar_index.h"
+
+#define CAT_CHUNK (64 * 1024)
+
+static const char *type_names[] = {"none", "file", "dir", "symlink", "hardlink"};
+
+static void cmd_ls(const tar_index_t *index, const char *path) {
+    const tar_entry_t *dir = tar_index_resolve(index, path);
+    if (dir == NULL || dir->typeflag != DIRTYPE) {
+        puts("-1");
+        return;
+    }
+    size_t total = tar_index_children(index, dir, NULL, 0);
+    const tar_entry_t **children = malloc((total ? total : 1) * sizeof(*children));
+    if (children == NULL) {
+        puts("-1");
+        return;
+    }
+    tar_index_children(index, dir, children, total);
+    printf("%zu\n", total);
+    for (size_t i = 0; i < total; ++i) puts(children[i]->name);
+    free(children);
+}
+
+/* Parses a whole decimal number, returns -1 if the word is anything else or does not fit */
+static int parse_number(const char *word, uint64_t *value) {
+    if (*word < '0' || *word > '9') return -1; // strtoull would accept a sign or spaces
+    char *end;
+    errno = 0;
+    unsigned long long parsed = strtoull(word, &end, 10);
+    if (*end != '\0' || errno == ERANGE) return -1;
+    *value = parsed;
+    return 0;
+}
+
+static void cmd_cat(const tar_index_t *index, int tar_fd, char *args) {
+    // The path may contain spaces, offset and length are the last two words
+    char *len_str = strrchr(args, ' ');
+    if (len_str == NULL) {
+        puts("?");
+        return;
+    }
+    *len_str++ = '\0';
+    char *offset_str = strrchr(args, ' ');
+    if (offset_str == NULL) {
+        puts("?");
+        return;
+    }
+    *offset_str++ = '\0';
+    uint64_t offset, len;
+    if (parse_number(offset_str, &offset) == -1 || parse_number(len_str, &len) == -1) {
+        puts("?");
+        return;
+    }
+
+    const tar_entry_t *entry = tar_index_resolve(index, args);
+    if (entry == NULL || tar_entry_type(entry) != 1) {
+        puts("-1 -1");
+        return;
+    }
+    // Compared unsigned, offsets past INT64_MAX must not wrap into the member
+    if (offset >= (uint64_t)entry->size) {
+        puts("-2 -1");
+        return;
+    }
+    uint64_t left = (uint64_t)entry->size - offset;
+    uint64_t n = len < left ? len : left;
+    // The length is announced before any byte is read, so it must be known to be available
+    struct stat st;
+    if (fstat(tar_fd, &st) == -1) {
+        puts("-3 -1");
+        return;
+    }
+    uint64_t available = st.st_size > entry->data_offset ? (uint64_t)(st.st_size - entry->data_offset) : 0;
+    if (offset > available || n > available - offset) {
+        puts("-3 -1");
+        return;
+    }
+    printf("%llu %llu\n", (unsigned long long)n, (unsigned long long)(left - n));
+
+    static uint8_t chunk[CAT_CHUNK];
+    while (n > 0) {
+        size_t want = n < sizeof(chunk) ? n : sizeof(chunk);
+        size_t got = want;
+        errno = 0;
+        if (tar_index_read(index, tar_fd, args, offset, chunk, &got) < 0 || got == 0) {
+            // The answer cannot be completed, stop rather than desynchronize the reader
+            fprintf(stderr, "tar_query: cannot read %s: %s\n", args, errno != 0 ? strerror(errno) : "archive truncated");
+            exit(1);
+        }
+        fwrite(chunk, 1, got, stdout);
+        offset += got;
+        n -= got;
+    }
+    putchar('\n');
+}
+
+int main(int argc, char **argv) {
+    FILE *commands = stdin;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:")) != -1) {
+        if (opt == 'f') {
+            commands = fopen(optarg, "r");
+            if (commands == NULL) {
+                perror(optarg);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Usage: %s [-f commands_file] archive\n", argv[0]);
+            return 2;
+        }
+    }
+    if (argc - optind != 1) {
+        fprintf(stderr, "Usage: %s [-f commands_file] archive\n", argv[0]);
+        return 2;
+    }
+
+    int tar_fd = open(argv[optind], O_RDONLY);
+    if (tar_fd == -1) {
+        perror(argv[optind]);
+        return 1;
+    }
+    tar_index_t *index = tar_index_build(tar_fd);
+    if (index == NULL) {
+        fprintf(stderr, "%s: cannot index archive\n", argv[optind]);
+        return 1;
+    }
+    // Answers are streamed in large writes unless someone is typing the commands
+    if (!isatty(STDOUT_FILENO)) setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+    else setvbuf(stdout, NULL, _IOLBF, 0);
+
+    int checked = 0, check_result = 0;
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t n;
+    while ((n = getline(&line, &capacity, commands)) != -1) {
+        if (n > 0 && line[n - 1] == '\n') line[--n] = '\0';
+        if (n > 0 && line[n - 1] == '\r') line[--n] = '\0';
+        char *args = strchr(line, ' ');
+        if (args != NULL) *args++ = '\0';
+        else args = line + n;
+
+        if (strcmp(line, "exists") == 0) {
+            puts(tar_index_lookup(index, args) != NULL ? "1" : "0");
+        } else if (strcmp(line, "type") == 0) {
+            const tar_entry_t *entry = tar_index_lookup(index, args);
+            puts(type_names[entry != NULL ? tar_entry_type(entry) : 0]);
+        } else if (strcmp(line, "ls") == 0) {
+            cmd_ls(index, args);
+        } else if (strcmp(line, "cat") == 0) {
+            cmd_cat(index, tar_fd, args);
+        } else if (strcmp(line, "check") == 0) {
+            // check_archive is a full scan, it is answered once per batch
+            if (!checked) {
+                check_result = check_archive(tar_fd);
+                checked = 1;
+            }
+            printf("%d\n", check_result);
+        } else {
+            puts("?");
+        }
+    }
+
+    free(line);
+    fflush(stdout);
+    tar_index_free(index);
+    close(tar_fd);
+    if (commands != stdin) fclose(commands);
+    return 0;
+}
@@ -0,0 +1,215 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "tar_scan.h"
+
+/* Helper thread reading one block at a time into one of two buffers */
+struct reader
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t *buffers[2];
+    int fd[2];
+    off_t offset[2];
+    ssize_t result[2];
+    int error[2];
+    int requested[2];             /* a read is wanted or in flight */
+    int done[2];                  /* its result is available */
+    int stopping;
+};
+
+static void *reader_thread(void *arg) {
+    struct reader *r = arg;
+    pthread_mutex_lock(&r->lock);
+    for (;;) {
+        int b = r->requested[0] && !r->done[0] ? 0 : r->requested[1] && !r->done[1] ? 1 : -1;
+        if (b == -1) {
+            if (r->stopping) break;
+            pthread_cond_wait(&r->cond, &r->lock);
+            continue;
+        }
+        int fd = r->fd[b];
+        off_t offset = r->offset[b];
+        pthread_mutex_unlock(&r->lock);
+
+        ssize_t n;
+        do {
+            n = pread(fd, r->buffers[b], TAR_SCAN_BLOCK, offset);
+        } while (n < 0 && errno == EINTR);
+        int error = n < 0 ? errno : 0;
+
+        pthread_mutex_lock(&r->lock);
+        r->result[b] = n;
+        r->error[b] = error;
+        r->done[b] = 1;
+        pthread_cond_broadcast(&r->cond);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+static void issue(struct reader *r, int b, int fd, off_t offset) {
+    pthread_mutex_lock(&r->lock);
+    r->fd[b] = fd;
+    r->offset[b] = offset;
+    r->requested[b] = 1;
+    r->done[b] = 0;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
+
+/* Waits for the read of buffer b, returns its result and sets errno on failure */
+static ssize_t await(struct reader *r, int b) {
+    pthread_mutex_lock(&r->lock);
+    while (!r->done[b]) pthread_cond_wait(&r->cond, &r->lock);
+    r->requested[b] = 0;
+    ssize_t n = r->result[b];
+    int error = r->error[b];
+    pthread_mutex_unlock(&r->lock);
+    if (n < 0) errno = error;
+    return n;
+}
+
+/* Opens the file behind tar_fd again, with O_DIRECT */
+static int reopen_direct(int tar_fd) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", tar_fd);
+    return open(path, O_RDONLY | O_DIRECT | O_CLOEXEC);
+}
+
+static void count_read(tar_scan_stats_t *stats, ssize_t n) {
+    if (n > 0) stats->bytes_read += (uint64_t)n;
+}
+
+static long scan_blocks(struct reader *r, int tar_fd, tar_stream_t *stream, tar_scan_stats_t *stats) {
+    struct stat st;
+    if (fstat(tar_fd, &st) == -1) return TAR_STREAM_EREAD;
+    int direct_fd = reopen_direct(tar_fd);
+    int fd = direct_fd != -1 ? direct_fd : tar_fd;
+    if (direct_fd == -1) tar_advise(tar_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    off_t offset = 0;
+    size_t consumed = 0;          /* bytes at the start of the block already accounted for */
+    int current = 0;
+    long result = 0;
+    issue(r, current, fd, offset);
+    for (;;) {
+        ssize_t n = await(r, current);
+        if (n < 0 && errno == EINVAL && fd == direct_fd) {
+            // The file system accepted the flag but not the reads, go through the page cache
+            close(direct_fd);
+            direct_fd = -1;
+            fd = tar_fd;
+            tar_advise(tar_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            issue(r, current, fd, offset);
+            continue;
+        }
+        if (n < 0) {
+            result = TAR_STREAM_EREAD;
+            break;
+        }
+        if ((size_t)n <= consumed) break;
+        count_read(stats, n);
+
+        // Read the next block while this one is parsed; a short block is the end of the file
+        off_t next = offset + n;
+        int other = !current;
+        int prefetched = n == TAR_SCAN_BLOCK;
+        if (prefetched) issue(r, other, fd, next);
+        int status = tar_stream_feed(stream, r->buffers[current] + consumed, (size_t)n - consumed);
+        if (fd == tar_fd) tar_advise(tar_fd, offset, n, POSIX_FADV_DONTNEED);
+        consumed = 0;
+        if (status != TAR_STREAM_MORE) {
+            if (prefetched) count_read(stats, await(r, other));
+            break;
+        }
+
+        // A skipped member reaching past the block being read ahead is jumped over
+        uint64_t jump = tar_stream_skippable(stream);
+        if (prefetched && jump > TAR_SCAN_BLOCK && next + (off_t)jump <= st.st_size) {
+            // The block read ahead holds skipped data only, it was read all the same
+            ssize_t wasted = await(r, other);
+            count_read(stats, wasted);
+            off_t target = next + (off_t)jump;
+            off_t aligned = target & ~(off_t)(TAR_SCAN_ALIGN - 1);
+            tar_stream_skip(stream, jump);
+            stats->bytes_skipped += jump - (wasted > 0 ? (uint64_t)wasted : 0);
+            consumed = (size_t)(target - aligned);
+            next = aligned;
+            issue(r, other, fd, next);
+        }
+        if (!prefetched) break;
+        offset = next;
+        current = other;
+    }
+    stats->direct = direct_fd != -1;
+    if (direct_fd != -1) close(direct_fd);
+    else tar_advise(tar_fd, 0, 0, POSIX_FADV_NORMAL); // tar_fd belongs to the caller
+    return result;
+}
+
+/**
+ * Scans a whole archive with large direct reads, bypassing the page cache.
+ *
+ * @param tar_fd A file descriptor on a tar archive file, its file offset is not used.
+ * @param callback Called for every event.
+ * @param arg Passed to callback.
+ * @param stats Out argument, may be NULL.
+ *
+ * @return The number of members seen, or a negative value as tar_stream_fd.
+ */
+long tar_scan(int tar_fd, tar_stream_cb callback, void *arg, tar_scan_stats_t *stats) {
+    tar_scan_stats_t local;
+    if (stats == NULL) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+    struct stat st;
+    if (fstat(tar_fd, &st) == -1) return TAR_STREAM_EREAD;
+    if (!S_ISREG(st.st_mode)) return tar_stream_fd(tar_fd, callback, arg);
+
+    struct reader r;
+    memset(&r, 0, sizeof(r));
+    r.buffers[0] = aligned_alloc(TAR_SCAN_ALIGN, TAR_SCAN_BLOCK);
+    r.buffers[1] = aligned_alloc(TAR_SCAN_ALIGN, TAR_SCAN_BLOCK);
+    pthread_t thread;
+    pthread_mutex_init(&r.lock, NULL);
+    pthread_cond_init(&r.cond, NULL);
+    long result = TAR_STREAM_EREAD;
+    if (r.buffers[0] != NULL && r.buffers[1] != NULL && pthread_create(&thread, NULL, reader_thread, &r) == 0) {
+        tar_stream_t stream;
+        tar_stream_init(&stream, callback, arg);
+        result = scan_blocks(&r, tar_fd, &stream, stats);
+        pthread_mutex_lock(&r.lock);
+        r.stopping = 1;
+        pthread_cond_broadcast(&r.cond);
+        pthread_mutex_unlock(&r.lock);
+        pthread_join(thread, NULL);
+        if (result == 0) result = tar_stream_finish(&stream);
+    }
+    pthread_cond_destroy(&r.cond);
+    pthread_mutex_destroy(&r.lock);
+    free(r.buffers[0]);
+    free(r.buffers[1]);
+    return result;
+}
+
+static int skip_data(const tar_stream_event_t *event, void *arg) {
+    return event->type == TAR_STREAM_HEADER ? TAR_STREAM_SKIP : TAR_STREAM_CONTINUE;
+}
+
+/**
+ * Checks an archive like check_archive, with tar_scan skipping the data of every member.
+ *
+ * Only members larger than two TAR_SCAN_BLOCK blocks are jumped over, and only in part:
+ * the data of the others is read along with the headers around it.
+ *
+ * @param tar_fd A file descriptor on a tar archive file.
+ *
+ * @return The number of headers, or the error codes of check_archive (-1 magic, -2 version,
+ *         -3 checksum, -4 negative size), or TAR_STREAM_TRUNCATED or TAR_STREAM_EREAD.
+ */
+int tar_scan_check(int tar_fd) {
+    return (int)tar_scan(tar_fd, skip_data, NULL, NULL);
+}
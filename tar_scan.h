@@ -0,0 +1,57 @@
+#ifndef TAR_SCAN_H
+#define TAR_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "tar_stream.h"
+
+/* Size of each read of the scanner, a multiple of TAR_SCAN_ALIGN */
+#define TAR_SCAN_BLOCK (4 * 1024 * 1024)
+/* Alignment of the buffers and offsets of direct reads */
+#define TAR_SCAN_ALIGN 4096
+
+typedef struct tar_scan_stats
+{
+    int direct;                   /* 1 if the archive was read with O_DIRECT, 0 if buffered */
+    uint64_t bytes_read;          /* read from the archive, including blocks read ahead then dropped */
+    uint64_t bytes_skipped;       /* data of skipped members jumped over without being read */
+} tar_scan_stats_t;
+
+/**
+ * Scans a whole archive with large direct reads, bypassing the page cache.
+ *
+ * The archive is reopened with O_DIRECT and read in TAR_SCAN_BLOCK blocks into aligned
+ * buffers. Two buffers are used: a helper thread reads the next block while the current one
+ * is parsed. The blocks go through the streaming parser (see tar_stream_feed), so headers
+ * are validated and the callback sees the same events. Skipped members larger than a block
+ * are jumped over.
+ *
+ * When the file system rejects O_DIRECT, the archive is read through the page cache from
+ * tar_fd instead, dropping each block from the cache once parsed (see tar_set_io_hints).
+ * The sequential access hint set on tar_fd for that is reset before returning.
+ *
+ * @param tar_fd A file descriptor on a tar archive file, its file offset is not used.
+ * @param callback Called for every event.
+ * @param arg Passed to callback.
+ * @param stats Out argument, may be NULL.
+ *
+ * @return The number of members seen, or a negative value as tar_stream_fd.
+ *
+ * Note: If tar_fd is not a regular file, tar_stream_fd is used from its current position.
+ */
+long tar_scan(int tar_fd, tar_stream_cb callback, void *arg, tar_scan_stats_t *stats);
+
+/**
+ * Checks an archive like check_archive, with tar_scan skipping the data of every member.
+ *
+ * Only members larger than two TAR_SCAN_BLOCK blocks are jumped over, and only in part:
+ * the data of the others is read along with the headers around it.
+ *
+ * @param tar_fd A file descriptor on a tar archive file.
+ *
+ * @return The number of headers, or the error codes of check_archive (-1 magic, -2 version,
+ *         -3 checksum, -4 negative size), or TAR_STREAM_TRUNCATED or TAR_STREAM_EREAD.
+ */
+int tar_scan_check(int tar_fd);
+
+#endif
@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "tar_index.h"
+#include "tar_search.h"
+#include "tar_workers.h"
+
+struct search
+{
+    int tar_fd;
+    const tar_index_t *index;
+    const uint8_t *pattern;
+    size_t pattern_len;
+    int flags;
+    tar_search_cb callback;
+    void *arg;
+    size_t next_entry;            /* next member to hand out, atomically incremented */
+    int stop;                     /* set when the callback asks to stop or on error */
+    int error;
+    ssize_t matches;
+    pthread_mutex_t lock;         /* serializes the callback */
+};
+
+/**
+ * Finds the first occurrence of a byte string in a buffer.
+ *
+ * With SSE2, 16 candidate positions are tested at once by comparing the first and the
+ * last byte of the needle, and only the positions where both match are verified with
+ * memcmp. This skips most of the haystack for any needle that is not made of frequent bytes.
+ *
+ * @param haystack The buffer to search.
+ * @param haystack_len Its length.
+ * @param needle The bytes to look for.
+ * @param needle_len Their number, at least 1.
+ *
+ * @return A pointer to the first occurrence, or NULL if there is none.
+ */
+const uint8_t *tar_memmem(const uint8_t *haystack, size_t haystack_len, const uint8_t *needle, size_t needle_len) {
+    if (needle_len == 0 || needle_len > haystack_len) return NULL;
+    if (needle_len == 1) return memchr(haystack, needle[0], haystack_len);
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8((char)needle[0]);
+    const __m128i last = _mm_set1_epi8((char)needle[needle_len - 1]);
+    for (; i + needle_len - 1 + 16 <= haystack_len; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i *)(haystack + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i *)(haystack + i + needle_len - 1));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+        while (mask != 0) {
+            unsigned int bit = (unsigned int)__builtin_ctz(mask);
+            if (memcmp(haystack + i + bit + 1, needle + 1, needle_len - 2) == 0) return haystack + i + bit;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    return memmem(haystack + i, haystack_len - i, needle, needle_len);
+}
+
+/* Scans one member chunk by chunk, returns -1 to stop the search */
+static int search_entry(struct search *s, const tar_entry_t *entry, uint8_t *buffer) {
+    size_t overlap = s->pattern_len - 1;
+    uint64_t scanned = 0;         /* member offset of buffer[0] */
+    size_t kept = 0;              /* bytes carried over from the previous chunk */
+    while (scanned + kept < (uint64_t)entry->size) {
+        size_t want = TAR_SEARCH_CHUNK;
+        if ((uint64_t)entry->size - scanned - kept < want) want = (size_t)((uint64_t)entry->size - scanned - kept);
+        size_t got = 0;
+        while (got < want) {
+            ssize_t n = pread(s->tar_fd, buffer + kept + got, want - got, entry->data_offset + (off_t)(scanned + kept + got));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                __atomic_store_n(&s->error, n < 0 ? errno : EIO, __ATOMIC_RELAXED);
+                return -1;
+            }
+            got += (size_t)n;
+        }
+        size_t len = kept + got;
+        const uint8_t *from = buffer;
+        const uint8_t *match;
+        while ((match = tar_memmem(from, len - (size_t)(from - buffer), s->pattern, s->pattern_len)) != NULL) {
+            pthread_mutex_lock(&s->lock);
+            int stop = __atomic_load_n(&s->stop, __ATOMIC_RELAXED);
+            if (!stop) {
+                s->matches++;
+                stop = s->callback(entry->name, scanned + (uint64_t)(match - buffer), s->arg) != 0;
+                if (stop) __atomic_store_n(&s->stop, 1, __ATOMIC_RELAXED);
+            }
+            pthread_mutex_unlock(&s->lock);
+            if (stop) return -1;
+            if (s->flags & TAR_SEARCH_FIRST_ONLY) return 0;
+            from = match + 1;
+        }
+        // Keep the tail that could be the start of a match spanning into the next chunk
+        kept = len < overlap ? len : overlap;
+        memmove(buffer, buffer + len - kept, kept);
+        scanned += len - kept;
+        if (__atomic_load_n(&s->stop, __ATOMIC_RELAXED)) return -1;
+    }
+    return 0;
+}
+
+static void *search_worker(void *arg) {
+    struct search *s = arg;
+    uint8_t *buffer = malloc(TAR_SEARCH_CHUNK + s->pattern_len);
+    if (buffer == NULL) {
+        __atomic_store_n(&s->error, ENOMEM, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->stop, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    while (!__atomic_load_n(&s->stop, __ATOMIC_RELAXED)) {
+        size_t i = __atomic_fetch_add(&s->next_entry, 1, __ATOMIC_RELAXED);
+        if (i >= s->index->count) break;
+        const tar_entry_t *entry = &s->index->entries[i];
+        if (tar_entry_type(entry) != 1 || entry->size < (int64_t)s->pattern_len) continue;
+        if (tar_index_lookup(s->index, entry->name) != entry) continue; // shadowed by an earlier entry
+        if (search_entry(s, entry, buffer) == -1) __atomic_store_n(&s->stop, 1, __ATOMIC_RELAXED);
+    }
+    free(buffer);
+    return NULL;
+}
+
+/**
+ * Searches the data of every regular file of an archive for a byte string.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param pattern The NUL-terminated string to look for, it must not be empty.
+ * @param flags Zero or TAR_SEARCH_FIRST_ONLY.
+ * @param nthreads Number of search threads, 0 uses one per online CPU.
+ * @param callback Called for every match, calls are serialized.
+ * @param arg Passed to callback.
+ *
+ * @return The number of matches reported, or -1 on error (errno is set).
+ */
+ssize_t tar_search(int tar_fd, const char *pattern, int flags, unsigned int nthreads, tar_search_cb callback, void *arg) {
+    if (pattern == NULL || pattern[0] == '\0' || callback == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    tar_index_t *index = tar_index_build(tar_fd);
+    if (index == NULL) return -1;
+
+    struct search s;
+    memset(&s, 0, sizeof(s));
+    s.tar_fd = tar_fd;
+    s.index = index;
+    s.pattern = (const uint8_t *)pattern;
+    s.pattern_len = strlen(pattern);
+    s.flags = flags;
+    s.callback = callback;
+    s.arg = arg;
+    pthread_mutex_init(&s.lock, NULL);
+
+    // Members are laid out in archive order, the kernel can read ahead for every thread
+    tar_advise(tar_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    tar_run_workers(nthreads, index->count, search_worker, &s);
+    tar_advise(tar_fd, 0, 0, POSIX_FADV_NORMAL);
+    pthread_mutex_destroy(&s.lock);
+    tar_index_free(index);
+
+    if (s.error != 0) {
+        errno = s.error;
+        return -1;
+    }
+    return s.matches;
+}
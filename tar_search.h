@@ -0,0 +1,56 @@
+#ifndef TAR_SEARCH_H
+#define TAR_SEARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Report only the first match of each member */
+#define TAR_SEARCH_FIRST_ONLY 0x1
+
+/* Size of the reads issued by each search thread */
+#define TAR_SEARCH_CHUNK (1024 * 1024)
+
+/**
+ * Callback of tar_search, called once per match.
+ *
+ * @param path The path of the member holding the match.
+ * @param offset The offset of the match from the start of the member data.
+ * @param arg The argument given to tar_search.
+ *
+ * @return zero to continue, any other value to stop the whole search.
+ */
+typedef int (*tar_search_cb)(const char *path, uint64_t offset, void *arg);
+
+/**
+ * Searches the data of every regular file of an archive for a byte string.
+ *
+ * The archive is indexed, then its members are shared among a pool of threads that
+ * read them with pread at their data offset and scan them with a vectorized substring
+ * kernel. Matches spanning read boundaries are found.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param pattern The NUL-terminated string to look for, it must not be empty.
+ * @param flags Zero or TAR_SEARCH_FIRST_ONLY.
+ * @param nthreads Number of search threads, 0 uses one per online CPU.
+ * @param callback Called for every match. Calls are serialized but come from the search
+ *                 threads, in no particular order across members.
+ * @param arg Passed to callback.
+ *
+ * @return The number of matches reported, or -1 on error (errno is set).
+ */
+ssize_t tar_search(int tar_fd, const char *pattern, int flags, unsigned int nthreads, tar_search_cb callback, void *arg);
+
+/**
+ * Finds the first occurrence of a byte string in a buffer.
+ *
+ * @param haystack The buffer to search.
+ * @param haystack_len Its length.
+ * @param needle The bytes to look for.
+ * @param needle_len Their number, at least 1.
+ *
+ * @return A pointer to the first occurrence, or NULL if there is none.
+ */
+const uint8_t *tar_memmem(const uint8_t *haystack, size_t haystack_len, const uint8_t *needle, size_t needle_len);
+
+#endif
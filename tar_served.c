@@ -0,0 +1,476 @@
+/**
+ * tar_served: serves the content of tar archives to local processes.
+ *
+ * The archives given on the command line are opened and indexed once, then shared by
+ * every client through a Unix domain socket, so clients neither rescan them nor keep
+ * their own index. Small reads go through a shared block cache.
+ *
+ * Usage: tar_served [-c cache_bytes] socket_path archive...
+ *        tar_served [-c cache_bytes] -i archive...
+ *
+ * With -i, the daemon serves the single connection it inherits as standard input (e.g.
+ * from inetd or a socketpair) instead of listening, and exits when it is closed.
+ *
+ * The protocol is line based: each request is one line, each reply starts with a line
+ * beginning with "OK" or "ERR <errno name>". Archives are designated by their position
+ * on the command line, starting at 0. Paths are the rest of the line and may contain spaces.
+ *
+ *   ARCHIVES                      OK <n>, then n lines "<id> <entries> <path>"
+ *   STAT <id> <path>              OK <type> <size> <mode> <mtime> [<linkname>]
+ *                                 type as returned by get_header_type, links are not followed
+ *   LIST <id> <path>              OK <n>, then n lines holding one entry path each
+ *   READ <id> <offset> <len> <path>
+ *                                 OK <n> <remaining>, then n raw bytes of the file,
+ *                                 symlinks are followed, remaining as returned by read_file
+ *   OPEN <id> <path>              OK <data_offset> <size>, the archive descriptor is passed
+ *                                 along with the reply (SCM_RIGHTS) so the client can pread
+ *                                 the file itself without any copy through the daemon
+ *   QUIT                          closes the connection
+ *
+ * Requests sent before the client shuts down its side of the connection are all answered
+ * before the daemon closes it.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "lib_tar.h"
+#include "tar_cache.h"
+#include "tar_index.h"
+
+#define MAX_EVENTS 64
+#define MAX_LINE 512
+/* Requests are not parsed while more than this many bytes wait to be sent */
+#define MAX_PENDING (1024 * 1024)
+#define DEFAULT_CACHE_BYTES (64 * 1024 * 1024)
+
+struct archive
+{
+    const char *path;
+    int fd;
+    tar_index_t *index;
+};
+
+/* A pending piece of reply: bytes from memory, or a range of an archive sent with sendfile */
+struct out_item
+{
+    struct out_item *next;
+    int pass_fd;                  /* descriptor sent with the first byte, -1 if none */
+    int file_fd;                  /* -1 for in-memory bytes */
+    off_t file_offset;
+    size_t len;
+    size_t pos;
+    char data[];
+};
+
+struct conn
+{
+    int fd;
+    char in[MAX_LINE];
+    size_t in_len;
+    struct out_item *out_head, *out_tail;
+    size_t out_bytes;
+    int want_write;
+    int eof;                      /* the client sent everything it will send */
+};
+
+static struct archive *archives;
+static int narchives;
+static int single_conn;
+static volatile sig_atomic_t stopping;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+static void queue_item(struct conn *c, struct out_item *item) {
+    item->next = NULL;
+    if (c->out_tail) c->out_tail->next = item;
+    else c->out_head = item;
+    c->out_tail = item;
+    c->out_bytes += item->len;
+}
+
+static int queue_bytes(struct conn *c, const char *data, size_t len, int pass_fd) {
+    struct out_item *item = malloc(sizeof(struct out_item) + len);
+    if (item == NULL) return -1;
+    item->pass_fd = pass_fd;
+    item->file_fd = -1;
+    item->len = len;
+    item->pos = 0;
+    memcpy(item->data, data, len);
+    queue_item(c, item);
+    return 0;
+}
+
+static int queue_printf(struct conn *c, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static int queue_printf(struct conn *c, const char *fmt, ...) {
+    char line[MAX_LINE + 64];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (n < 0) return -1;
+    return queue_bytes(c, line, (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1, -1);
+}
+
+static int queue_file(struct conn *c, int file_fd, off_t offset, size_t len) {
+    struct out_item *item = malloc(sizeof(struct out_item));
+    if (item == NULL) return -1;
+    item->pass_fd = -1;
+    item->file_fd = file_fd;
+    item->file_offset = offset;
+    item->len = len;
+    item->pos = 0;
+    queue_item(c, item);
+    return 0;
+}
+
+static ssize_t send_with_fd(int sock, const char *data, size_t len, int pass_fd) {
+    struct iovec iov = {(void *)data, len};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+    return sendmsg(sock, &msg, MSG_NOSIGNAL);
+}
+
+/* Sends as much of the queue as the socket accepts, returns -1 if the connection broke */
+static int flush(struct conn *c) {
+    while (c->out_head != NULL) {
+        struct out_item *item = c->out_head;
+        ssize_t n;
+        if (item->file_fd != -1) {
+            off_t offset = item->file_offset + (off_t)item->pos;
+            n = sendfile(c->fd, item->file_fd, &offset, item->len - item->pos);
+            if (n == 0) return -1; // the archive is shorter than its index says
+        } else if (item->pass_fd != -1 && item->pos == 0) {
+            n = send_with_fd(c->fd, item->data, item->len, item->pass_fd);
+        } else {
+            n = send(c->fd, item->data + item->pos, item->len - item->pos, MSG_NOSIGNAL);
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        item->pos += (size_t)n;
+        c->out_bytes -= (size_t)n;
+        if (item->pos == item->len) {
+            c->out_head = item->next;
+            if (c->out_head == NULL) c->out_tail = NULL;
+            free(item);
+        }
+    }
+    return 0;
+}
+
+static struct archive *parse_archive(const char **args) {
+    char *end;
+    long id = strtol(*args, &end, 10);
+    if (end == *args || (*end != ' ' && *end != '\0') || id < 0 || id >= narchives) return NULL;
+    *args = *end == ' ' ? end + 1 : end;
+    return &archives[id];
+}
+
+static int do_stat(struct conn *c, struct archive *a, const char *path) {
+    const tar_entry_t *entry = tar_index_lookup(a->index, path);
+    if (entry == NULL) return queue_printf(c, "ERR ENOENT\n");
+    int type = tar_entry_type(entry);
+    if (type == 3 || type == 4) {
+        return queue_printf(c, "OK %d %lld %o %lld %s\n", type, (long long)entry->size, entry->mode,
+                            (long long)entry->mtime, entry->linkname);
+    }
+    return queue_printf(c, "OK %d %lld %o %lld\n", type, (long long)entry->size, entry->mode, (long long)entry->mtime);
+}
+
+static int do_list(struct conn *c, struct archive *a, const char *path) {
+    const tar_entry_t *dir = tar_index_resolve(a->index, path);
+    if (dir == NULL) return queue_printf(c, "ERR ENOENT\n");
+    if (dir->typeflag != DIRTYPE) return queue_printf(c, "ERR ENOTDIR\n");
+    size_t total = tar_index_children(a->index, dir, NULL, 0);
+    const tar_entry_t **children = malloc((total ? total : 1) * sizeof(*children));
+    if (children == NULL) return queue_printf(c, "ERR ENOMEM\n");
+    tar_index_children(a->index, dir, children, total);
+    int err = queue_printf(c, "OK %zu\n", total);
+    for (size_t i = 0; i < total && err == 0; ++i) err = queue_printf(c, "%s\n", children[i]->name);
+    free(children);
+    return err;
+}
+
+static int do_read(struct conn *c, struct archive *a, const char *args) {
+    unsigned long long offset, len;
+    int consumed = 0;
+    if (sscanf(args, "%llu %llu %n", &offset, &len, &consumed) < 2 || consumed == 0) {
+        return queue_printf(c, "ERR EINVAL\n");
+    }
+    const tar_entry_t *entry = tar_index_resolve(a->index, args + consumed);
+    if (entry == NULL || tar_entry_type(entry) != 1) return queue_printf(c, "ERR ENOENT\n");
+    if (offset >= (uint64_t)entry->size) return queue_printf(c, "ERR ERANGE\n"); // unsigned, huge offsets must not wrap
+    uint64_t left = (uint64_t)entry->size - offset;
+    uint64_t n = len < left ? len : left;
+    if (queue_printf(c, "OK %llu %llu\n", (unsigned long long)n, (unsigned long long)(left - n)) == -1) return -1;
+    if (n == 0) return 0;
+    if (n <= TAR_CACHE_MAX_READ && tar_cache_attached(a->fd) != NULL) {
+        // Small reads are copied out of the shared block cache
+        char *buf = malloc(n);
+        if (buf == NULL) return -1;
+        ssize_t got = tar_cached_pread(a->fd, buf, n, entry->data_offset + (off_t)offset);
+        int err = got == (ssize_t)n ? queue_bytes(c, buf, n, -1) : -1;
+        free(buf);
+        return err;
+    }
+    tar_advise(a->fd, entry->data_offset + (off_t)offset, (off_t)n, POSIX_FADV_WILLNEED);
+    return queue_file(c, a->fd, entry->data_offset + (off_t)offset, n);
+}
+
+static int do_open(struct conn *c, struct archive *a, const char *path) {
+    const tar_entry_t *entry = tar_index_resolve(a->index, path);
+    if (entry == NULL || tar_entry_type(entry) != 1) return queue_printf(c, "ERR ENOENT\n");
+    char line[64];
+    int n = snprintf(line, sizeof(line), "OK %lld %lld\n", (long long)entry->data_offset, (long long)entry->size);
+    return queue_bytes(c, line, (size_t)n, a->fd);
+}
+
+/* Handles one request line, returns -1 to close the connection */
+static int handle_request(struct conn *c, char *line) {
+    char *args = strchr(line, ' ');
+    if (args != NULL) *args++ = '\0';
+    else args = line + strlen(line);
+
+    if (strcmp(line, "QUIT") == 0) return -1;
+    if (strcmp(line, "ARCHIVES") == 0) {
+        int err = queue_printf(c, "OK %d\n", narchives);
+        for (int i = 0; i < narchives && err == 0; ++i) {
+            err = queue_printf(c, "%d %zu %s\n", i, archives[i].index->count, archives[i].path);
+        }
+        return err;
+    }
+
+    const char *rest = args;
+    struct archive *a = parse_archive(&rest);
+    if (a == NULL) return queue_printf(c, "ERR EBADF\n");
+    if (strcmp(line, "STAT") == 0) return do_stat(c, a, rest);
+    if (strcmp(line, "LIST") == 0) return do_list(c, a, rest);
+    if (strcmp(line, "READ") == 0) return do_read(c, a, rest);
+    if (strcmp(line, "OPEN") == 0) return do_open(c, a, rest);
+    return queue_printf(c, "ERR ENOSYS\n");
+}
+
+/* Parses the buffered requests as long as the replies do not pile up */
+static int process_input(struct conn *c) {
+    while (c->out_bytes < MAX_PENDING) {
+        char *newline = memchr(c->in, '\n', c->in_len);
+        if (newline == NULL) {
+            if (c->in_len == sizeof(c->in)) return -1; // request line too long
+            return 0;
+        }
+        *newline = '\0';
+        if (newline > c->in && newline[-1] == '\r') newline[-1] = '\0';
+        if (handle_request(c, c->in) == -1) return -1;
+        size_t used = (size_t)(newline - c->in) + 1;
+        memmove(c->in, c->in + used, c->in_len - used);
+        c->in_len -= used;
+    }
+    return 0;
+}
+
+static void close_conn(int epfd, struct conn *c) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    while (c->out_head != NULL) {
+        struct out_item *next = c->out_head->next;
+        free(c->out_head);
+        c->out_head = next;
+    }
+    free(c);
+    if (single_conn) stopping = 1;
+}
+
+static void handle_conn(int epfd, struct conn *c, uint32_t events) {
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        close_conn(epfd, c);
+        return;
+    }
+    if (events & EPOLLIN) {
+        ssize_t n = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+        if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            close_conn(epfd, c);
+            return;
+        }
+        if (n > 0) c->in_len += (size_t)n;
+        if (n == 0) c->eof = 1; // answer what was already received before closing
+    }
+    // Alternate between sending and parsing until the socket or the input runs dry
+    for (;;) {
+        if (process_input(c) == -1 || flush(c) == -1) {
+            close_conn(epfd, c);
+            return;
+        }
+        if (c->out_head != NULL || memchr(c->in, '\n', c->in_len) == NULL) break;
+    }
+    if (c->eof && c->out_head == NULL) {
+        close_conn(epfd, c);
+        return;
+    }
+
+    int want_write = c->out_head != NULL;
+    if (want_write != c->want_write) {
+        // Stop reading while replies are blocked, so a slow client cannot make us buffer without bound
+        struct epoll_event ev = {.events = want_write ? EPOLLOUT : EPOLLIN, .data.ptr = c};
+        epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->want_write = want_write;
+    }
+}
+
+static int open_archives(char **paths, int count, tar_cache_t *cache) {
+    archives = calloc((size_t)count, sizeof(struct archive));
+    if (archives == NULL) return -1;
+    for (int i = 0; i < count; ++i) {
+        archives[i].path = paths[i];
+        archives[i].fd = open(paths[i], O_RDONLY | O_CLOEXEC);
+        if (archives[i].fd == -1) {
+            perror(paths[i]);
+            return -1;
+        }
+        archives[i].index = tar_index_build(archives[i].fd);
+        if (archives[i].index == NULL) {
+            fprintf(stderr, "%s: cannot index archive\n", paths[i]);
+            return -1;
+        }
+        if (tar_cache_attach(archives[i].fd, cache) == -1) {
+            perror("tar_cache_attach");
+            return -1;
+        }
+        narchives++;
+    }
+    return 0;
+}
+
+static int listen_on(const char *socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    unlink(socket_path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char **argv) {
+    size_t cache_bytes = DEFAULT_CACHE_BYTES;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:i")) != -1) {
+        if (opt == 'c') {
+            cache_bytes = strtoull(optarg, NULL, 10);
+        } else if (opt == 'i') {
+            single_conn = 1;
+        } else {
+            optind = argc;
+            break;
+        }
+    }
+    if (argc - optind < 2 - single_conn) {
+        fprintf(stderr, "Usage: %s [-c cache_bytes] socket_path archive...\n"
+                        "       %s [-c cache_bytes] -i archive...\n", argv[0], argv[0]);
+        return 2;
+    }
+    const char *socket_path = single_conn ? NULL : argv[optind++];
+
+    tar_cache_t *cache = cache_bytes ? tar_cache_new(cache_bytes, 0) : NULL;
+    if (open_archives(argv + optind, argc - optind, cache) == -1) return 1;
+
+    int listen_fd = single_conn ? STDIN_FILENO : listen_on(socket_path);
+    if (listen_fd == -1) {
+        perror(socket_path);
+        return 1;
+    }
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct conn *inherited = single_conn ? calloc(1, sizeof(struct conn)) : NULL;
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = inherited};
+    if (single_conn && (inherited == NULL || fcntl(listen_fd, F_SETFL, O_NONBLOCK) == -1)) {
+        perror("tar_served");
+        return 1;
+    }
+    if (inherited != NULL) inherited->fd = listen_fd;
+    if (epfd == -1 || epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev) == -1) {
+        perror("epoll");
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (!stopping) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.ptr != NULL) {
+                handle_conn(epfd, events[i].data.ptr, events[i].events);
+                continue;
+            }
+            int client;
+            while ((client = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+                struct conn *c = calloc(1, sizeof(struct conn));
+                struct epoll_event cev = {.events = EPOLLIN, .data.ptr = c};
+                if (c == NULL || epoll_ctl(epfd, EPOLL_CTL_ADD, client, &cev) == -1) {
+                    free(c);
+                    close(client);
+                    continue;
+                }
+                c->fd = client;
+            }
+        }
+    }
+
+    if (!single_conn) {
+        close(listen_fd);
+        unlink(socket_path);
+    }
+    for (int i = 0; i < narchives; ++i) {
+        tar_cache_attach(archives[i].fd, NULL);
+        tar_index_free(archives[i].index);
+        close(archives[i].fd);
+    }
+    free(archives);
+    tar_cache_free(cache);
+    return 0;
+}
@@ -0,0 +1,272 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "tar_shindex.h"
+
+#define TAR_SHINDEX_MAGIC "TARSHIX2"
+
+static uint64_t align_up(uint64_t value) {
+    return (value + 63) & ~(uint64_t)63;
+}
+
+/* Marks an empty segment as being built by this process, before the index is */
+static int claim(int shm_fd) {
+    if (ftruncate(shm_fd, sizeof(struct tar_shindex_header)) == -1) return -1;
+    struct tar_shindex_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TAR_SHINDEX_MAGIC, sizeof(header.magic));
+    header.sequence = 1;
+    header.builder_pid = getpid();
+    return pwrite(shm_fd, &header, sizeof(header), 0) == sizeof(header) ? 0 : -1;
+}
+
+/* Checks whether the process building an unpublished segment is gone */
+static int builder_died(int shm_fd) {
+    struct tar_shindex_header header;
+    if (pread(shm_fd, &header, sizeof(header), 0) != sizeof(header)) return 0; // not claimed yet
+    if (header.builder_pid <= 0 || (header.sequence != 0 && !(header.sequence & 1))) return 0;
+    return kill((pid_t)header.builder_pid, 0) == -1 && errno == ESRCH;
+}
+
+/* Writes an index into shm_fd, the sequence word is made even last */
+static int publish(int shm_fd, const tar_index_t *index) {
+    uint64_t entries_offset = align_up(sizeof(struct tar_shindex_header));
+    uint64_t slots_offset = align_up(entries_offset + index->count * sizeof(tar_entry_t));
+    uint64_t total_size = slots_offset + index->nslots * sizeof(uint32_t);
+    if (ftruncate(shm_fd, (off_t)total_size) == -1) return -1;
+    uint8_t *base = mmap(NULL, total_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (base == MAP_FAILED) return -1;
+
+    struct tar_shindex_header *header = (struct tar_shindex_header *)base;
+    __atomic_store_n(&header->sequence, 1, __ATOMIC_RELAXED);
+    memcpy(header->magic, TAR_SHINDEX_MAGIC, sizeof(header->magic));
+    header->builder_pid = getpid();
+    header->archive_dev = index->archive_dev;
+    header->archive_ino = index->archive_ino;
+    header->archive_size = index->archive_size;
+    header->archive_mtime = index->archive_mtime;
+    header->count = index->count;
+    header->nslots = index->nslots;
+    header->entries_offset = entries_offset;
+    header->slots_offset = slots_offset;
+    header->total_size = total_size;
+    memcpy(base + entries_offset, index->entries, index->count * sizeof(tar_entry_t));
+    memcpy(base + slots_offset, index->slots, index->nslots * sizeof(uint32_t));
+    // Readers that see the even value also see everything written above
+    __atomic_store_n(&header->sequence, 2, __ATOMIC_RELEASE);
+    munmap(base, total_size);
+    return 0;
+}
+
+/* Checks that count items of item_size bytes at offset lie inside the published segment */
+static int fits(const struct tar_shindex_header *header, size_t item_size, uint64_t offset, uint64_t count) {
+    if (offset % 8 != 0 || offset < sizeof(*header) || offset > header->total_size) return 0;
+    return count <= (header->total_size - offset) / item_size;
+}
+
+/* Checks that lookups stay inside the entries and always reach an empty slot */
+static int valid_slots(const uint8_t *base, const struct tar_shindex_header *header) {
+    const uint32_t *slots = (const uint32_t *)(base + header->slots_offset);
+    int empty = 0;
+    for (uint64_t i = 0; i < header->nslots; ++i) {
+        if (slots[i] > header->count) return 0;
+        if (slots[i] == 0) empty = 1;
+    }
+    return empty;
+}
+
+static int build_into(int shm_fd, int tar_fd) {
+    tar_index_t *index = tar_index_build(tar_fd);
+    if (index == NULL) return -1;
+    int result = publish(shm_fd, index);
+    tar_index_free(index);
+    return result;
+}
+
+/**
+ * Attaches a published shared index read-only.
+ *
+ * @param shm_fd A descriptor returned by tar_shindex_create_fd, or on a shared memory object.
+ * @param tar_fd The archive the index is meant for, or -1 to skip the check.
+ *
+ * @return The view, or NULL on error (errno is set, ESTALE if the index describes another
+ *         version of the archive, EAGAIN if it is not published yet, EINVAL if the segment
+ *         is not a shared index, its offsets and counts do not fit in it, or its slot table
+ *         points outside the entries or has no empty slot).
+ */
+tar_shindex_t *tar_shindex_attach_fd(int shm_fd, int tar_fd) {
+    struct stat st;
+    uint8_t *base;
+    const struct tar_shindex_header *header;
+    uint64_t sequence;
+    for (;;) {
+        if (fstat(shm_fd, &st) == -1) return NULL;
+        if ((size_t)st.st_size < sizeof(struct tar_shindex_header)) {
+            errno = EAGAIN; // the creator has not sized the segment yet
+            return NULL;
+        }
+        base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, shm_fd, 0);
+        if (base == MAP_FAILED) return NULL;
+        header = (const struct tar_shindex_header *)base;
+        sequence = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+        // Published after our fstat: the segment was resized before the sequence word changed
+        if (sequence == 0 || (sequence & 1) || header->total_size <= (uint64_t)st.st_size) break;
+        struct stat now;
+        if (fstat(shm_fd, &now) == -1 || now.st_size <= st.st_size) break;
+        munmap(base, (size_t)st.st_size);
+    }
+
+    int error = 0;
+    if (sequence == 0 || (sequence & 1)) error = EAGAIN;
+    else if (memcmp(header->magic, TAR_SHINDEX_MAGIC, sizeof(header->magic)) != 0 || header->total_size > (uint64_t)st.st_size
+             || !fits(header, sizeof(tar_entry_t), header->entries_offset, header->count)
+             || !fits(header, sizeof(uint32_t), header->slots_offset, header->nslots)
+             || (header->nslots & (header->nslots - 1)) != 0 || header->nslots <= header->count || header->count >= UINT32_MAX
+             || !valid_slots(base, header)) error = EINVAL;
+    else if (tar_fd != -1) {
+        struct stat archive;
+        if (fstat(tar_fd, &archive) == -1) error = errno;
+        else if (archive.st_dev != header->archive_dev || archive.st_ino != header->archive_ino
+                 || archive.st_size != header->archive_size || archive.st_mtime != header->archive_mtime) error = ESTALE;
+    }
+    tar_shindex_t *shindex = error == 0 ? calloc(1, sizeof(tar_shindex_t)) : NULL;
+    if (shindex == NULL) {
+        munmap(base, (size_t)st.st_size);
+        if (error != 0) errno = error;
+        return NULL;
+    }
+    shindex->base = base;
+    shindex->size = (size_t)st.st_size;
+    // The view points into the mapping, the index functions never write through it
+    shindex->index.entries = (tar_entry_t *)(base + header->entries_offset);
+    shindex->index.count = header->count;
+    shindex->index.slots = (uint32_t *)(base + header->slots_offset);
+    shindex->index.nslots = header->nslots;
+    shindex->index.archive_dev = header->archive_dev;
+    shindex->index.archive_ino = header->archive_ino;
+    shindex->index.archive_size = header->archive_size;
+    shindex->index.archive_mtime = header->archive_mtime;
+    return shindex;
+}
+
+/**
+ * Attaches the shared index of an archive, building and publishing it if needed.
+ *
+ * @param name The name of the shared memory object, e.g. "/tar_index_data".
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ *
+ * @return The view, or NULL on error (errno is set).
+ */
+tar_shindex_t *tar_shindex_open(const char *name, int tar_fd) {
+    return tar_shindex_open_wait(name, tar_fd, 0);
+}
+
+/**
+ * Same as tar_shindex_open, with a caller-chosen wait for the publication.
+ *
+ * @param name The name of the shared memory object.
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param wait_ms How long to wait for another process to publish the index, 0 picks the
+ *                default of tar_shindex_open.
+ *
+ * @return The view, or NULL on error (errno is set).
+ */
+tar_shindex_t *tar_shindex_open_wait(const char *name, int tar_fd, long wait_ms) {
+    if (wait_ms <= 0) {
+        struct stat archive;
+        if (fstat(tar_fd, &archive) == -1) return NULL;
+        wait_ms = TAR_SHINDEX_WAIT_MS + (long)(archive.st_size / TAR_SHINDEX_WAIT_BYTES_PER_MS);
+    }
+    for (;;) {
+        int shm_fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (shm_fd != -1) {
+            if (claim(shm_fd) == -1 || build_into(shm_fd, tar_fd) == -1) {
+                int error = errno;
+                shm_unlink(name); // let the next process try again
+                close(shm_fd);
+                errno = error;
+                return NULL;
+            }
+        } else if (errno == EEXIST) {
+            shm_fd = shm_open(name, O_RDONLY, 0);
+            if (shm_fd == -1 && errno == ENOENT) continue; // removed meanwhile, try to create it
+        }
+        if (shm_fd == -1) return NULL;
+
+        // Another process may still be building the index: poll the sequence word
+        tar_shindex_t *shindex = NULL;
+        int orphaned = 0;
+        struct timespec pause = {0, 100 * 1000};
+        for (long waited_us = 0; waited_us <= wait_ms * 1000L; waited_us += pause.tv_nsec / 1000) {
+            shindex = tar_shindex_attach_fd(shm_fd, tar_fd);
+            if (shindex != NULL || errno != EAGAIN) break;
+            if ((orphaned = builder_died(shm_fd))) break;
+            nanosleep(&pause, NULL);
+        }
+        int error = errno;
+        if (orphaned) {
+            // Remove the name only if it still designates the abandoned segment
+            struct stat abandoned, current;
+            int current_fd = shm_open(name, O_RDONLY, 0);
+            if (current_fd != -1) {
+                if (fstat(shm_fd, &abandoned) == 0 && fstat(current_fd, &current) == 0 && abandoned.st_ino == current.st_ino) {
+                    shm_unlink(name);
+                }
+                close(current_fd);
+            }
+            close(shm_fd);
+            continue;
+        }
+        close(shm_fd); // the mapping stays valid
+        if (shindex == NULL) errno = error == EAGAIN ? ETIMEDOUT : error;
+        return shindex;
+    }
+}
+
+/**
+ * Removes the name of a shared index. Processes that attached it keep their view.
+ *
+ * @param name The name given to tar_shindex_open.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int tar_shindex_unlink(const char *name) {
+    return shm_unlink(name);
+}
+
+/**
+ * Builds the index of an archive in an anonymous memory file.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ *
+ * @return A descriptor on the published index, or -1 on error.
+ */
+int tar_shindex_create_fd(int tar_fd) {
+    int shm_fd = memfd_create("tar_index", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (shm_fd == -1) return -1;
+    if (build_into(shm_fd, tar_fd) == -1) {
+        int error = errno;
+        close(shm_fd);
+        errno = error;
+        return -1;
+    }
+    // Workers receiving the descriptor cannot alter or resize the published index
+    fcntl(shm_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    return shm_fd;
+}
+
+/**
+ * Unmaps a view returned by tar_shindex_open or tar_shindex_attach_fd.
+ *
+ * @param shindex The view, may be NULL.
+ */
+void tar_shindex_detach(tar_shindex_t *shindex) {
+    if (shindex == NULL) return;
+    munmap(shindex->base, shindex->size);
+    free(shindex);
+}
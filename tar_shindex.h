@@ -0,0 +1,112 @@
+#ifndef TAR_SHINDEX_H
+#define TAR_SHINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "tar_index.h"
+
+/* How long an attaching process waits for another one to publish the index... */
+#define TAR_SHINDEX_WAIT_MS 5000
+/* ...plus one millisecond per this many bytes of archive, building takes longer for large ones */
+#define TAR_SHINDEX_WAIT_BYTES_PER_MS (64 * 1024)
+
+/*
+ * Header of a shared index segment. The entries and the slot table follow it; they are
+ * located by offsets from the start of the segment, so every process may map it anywhere.
+ */
+struct tar_shindex_header
+{
+    char     magic[8];
+    uint64_t sequence;                /* odd while the index is written, even and non-zero once published */
+    int64_t  builder_pid;             /* process writing the index, set before anything else */
+    uint64_t archive_dev;             /* identity of the indexed archive */
+    uint64_t archive_ino;
+    int64_t  archive_size;
+    int64_t  archive_mtime;
+    uint64_t count;
+    uint64_t nslots;
+    uint64_t entries_offset;
+    uint64_t slots_offset;
+    uint64_t total_size;
+};
+
+/* A read-only view of a shared index */
+typedef struct tar_shindex
+{
+    tar_index_t index;                /* usable with every tar_index_* function that takes a const index */
+    void *base;                       /* the mapping */
+    size_t size;
+} tar_shindex_t;
+
+/**
+ * Attaches the shared index of an archive, building and publishing it if needed.
+ *
+ * The first process to open a name creates the POSIX shared memory object, records its
+ * pid in it, indexes the archive into it and publishes it by making the sequence word even.
+ * The others map it read-only, waiting at most TAR_SHINDEX_WAIT_MS plus one millisecond per
+ * TAR_SHINDEX_WAIT_BYTES_PER_MS bytes of archive for the publication. If the builder dies
+ * before publishing, a waiter removes the name and builds the index itself.
+ *
+ * @param name The name of the shared memory object, e.g. "/tar_index_data".
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ *
+ * @return The view, or NULL on error (errno is set). errno is ESTALE if the published index
+ *         describes another version of the archive: unlink the name and open it again.
+ *         It is ETIMEDOUT if the index was not published in time.
+ */
+tar_shindex_t *tar_shindex_open(const char *name, int tar_fd);
+
+/**
+ * Same as tar_shindex_open, with a caller-chosen wait for the publication.
+ *
+ * @param name The name of the shared memory object.
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param wait_ms How long to wait for another process to publish the index, 0 picks the
+ *                default of tar_shindex_open.
+ *
+ * @return The view, or NULL on error (errno is set, see tar_shindex_open).
+ */
+tar_shindex_t *tar_shindex_open_wait(const char *name, int tar_fd, long wait_ms);
+
+/**
+ * Removes the name of a shared index. Processes that attached it keep their view.
+ *
+ * @param name The name given to tar_shindex_open.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int tar_shindex_unlink(const char *name);
+
+/**
+ * Builds the index of an archive in an anonymous memory file.
+ *
+ * The returned descriptor can be inherited by forked workers or sent over a Unix socket,
+ * then attached with tar_shindex_attach_fd.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ *
+ * @return A descriptor on the published index, or -1 on error.
+ */
+int tar_shindex_create_fd(int tar_fd);
+
+/**
+ * Attaches a published shared index read-only.
+ *
+ * @param shm_fd A descriptor returned by tar_shindex_create_fd, or on a shared memory object.
+ * @param tar_fd The archive the index is meant for, or -1 to skip the check.
+ *
+ * @return The view, or NULL on error (errno is set, ESTALE if the index describes another
+ *         version of the archive, EAGAIN if it is not published yet, EINVAL if the segment
+ *         is not a shared index, its offsets and counts do not fit in it, or its slot table
+ *         points outside the entries or has no empty slot).
+ */
+tar_shindex_t *tar_shindex_attach_fd(int shm_fd, int tar_fd);
+
+/**
+ * Unmaps a view returned by tar_shindex_open or tar_shindex_attach_fd.
+ *
+ * @param shindex The view, may be NULL.
+ */
+void tar_shindex_detach(tar_shindex_t *shindex);
+
+#endif
@@ -0,0 +1,116 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "tar_sidecar.h"
+
+/**
+ * Writes a whole buffer, retrying short writes.
+ *
+ * @param fd A file descriptor opened for writing.
+ * @param buf The bytes to write.
+ * @param len Number of bytes to write.
+ *
+ * @return 0 on success, -1 on write error.
+ */
+int tar_write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * Reads a whole buffer, retrying short reads.
+ *
+ * @param fd A file descriptor opened for reading.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read.
+ *
+ * @return 0 on success, -1 on read error or if the file ends first (errno is EINVAL).
+ */
+int tar_read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) errno = EINVAL; // truncated file
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * Writes the header of a sidecar file.
+ *
+ * @param out_fd A file descriptor opened for writing.
+ * @param magic The 8 bytes identifying the kind of sidecar.
+ * @param version The version of its layout.
+ * @param param A value specific to the kind of sidecar.
+ * @param count Number of items the caller writes after the header.
+ * @param archive_size Size of the archive the items were computed from.
+ * @param archive_mtime Modification time of that archive.
+ *
+ * @return 0 on success, -1 on write error.
+ */
+int tar_sidecar_write(int out_fd, const char *magic, uint32_t version, uint32_t param, uint64_t count,
+                      int64_t archive_size, int64_t archive_mtime) {
+    tar_sidecar_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic, sizeof(header.magic));
+    header.version = version;
+    header.param = param;
+    header.count = count;
+    header.archive_size = archive_size;
+    header.archive_mtime = archive_mtime;
+    return tar_write_all(out_fd, &header, sizeof(header));
+}
+
+/**
+ * Reads and checks the header of a sidecar file.
+ *
+ * @param in_fd A file descriptor opened for reading, positioned at the sidecar.
+ * @param magic The expected 8 bytes identifying the kind of sidecar.
+ * @param version The expected version of its layout.
+ * @param item_size Size in bytes of one of the items following the header.
+ * @param tar_fd The archive the sidecar is meant for, or -1 to skip the check.
+ * @param header Out argument, set to the header read.
+ *
+ * @return 0 if the items can be read, -1 otherwise (errno is EINVAL or ESTALE).
+ */
+int tar_sidecar_read(int in_fd, const char *magic, uint32_t version, size_t item_size, int tar_fd,
+                     tar_sidecar_header_t *header) {
+    if (tar_read_all(in_fd, header, sizeof(*header)) == -1) return -1;
+    if (memcmp(header->magic, magic, sizeof(header->magic)) != 0 || header->version != version
+        || header->count > SIZE_MAX / item_size) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct stat st;
+    if (fstat(in_fd, &st) == -1) return -1;
+    if (S_ISREG(st.st_mode)) { // The items must fit in what is left of the sidecar
+        off_t position = lseek(in_fd, 0, SEEK_CUR);
+        if (position == -1) return -1;
+        if ((uint64_t)(st.st_size - position) < header->count * item_size) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    if (tar_fd != -1) {
+        if (fstat(tar_fd, &st) == -1) return -1;
+        if (st.st_size != header->archive_size || st.st_mtime != header->archive_mtime) {
+            errno = ESTALE;
+            return -1;
+        }
+    }
+    return 0;
+}
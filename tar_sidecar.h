@@ -0,0 +1,77 @@
+#ifndef TAR_SIDECAR_H
+#define TAR_SIDECAR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Header shared by the sidecar files saved next to an archive (Bloom filters, digests),
+   followed by count items (host byte order) */
+typedef struct tar_sidecar_header
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t param;               /* meaning depends on the sidecar, e.g. the digest algorithm */
+    uint64_t count;               /* number of items following the header */
+    int64_t  archive_size;        /* identity of the archive the sidecar was computed from */
+    int64_t  archive_mtime;
+} tar_sidecar_header_t;
+
+/**
+ * Writes a whole buffer, retrying short writes.
+ *
+ * @param fd A file descriptor opened for writing.
+ * @param buf The bytes to write.
+ * @param len Number of bytes to write.
+ *
+ * @return 0 on success, -1 on write error.
+ */
+int tar_write_all(int fd, const void *buf, size_t len);
+
+/**
+ * Reads a whole buffer, retrying short reads.
+ *
+ * @param fd A file descriptor opened for reading.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read.
+ *
+ * @return 0 on success, -1 on read error or if the file ends first (errno is EINVAL).
+ */
+int tar_read_all(int fd, void *buf, size_t len);
+
+/**
+ * Writes the header of a sidecar file.
+ *
+ * @param out_fd A file descriptor opened for writing.
+ * @param magic The 8 bytes identifying the kind of sidecar.
+ * @param version The version of its layout.
+ * @param param A value specific to the kind of sidecar.
+ * @param count Number of items the caller writes after the header.
+ * @param archive_size Size of the archive the items were computed from.
+ * @param archive_mtime Modification time of that archive.
+ *
+ * @return 0 on success, -1 on write error.
+ */
+int tar_sidecar_write(int out_fd, const char *magic, uint32_t version, uint32_t param, uint64_t count,
+                      int64_t archive_size, int64_t archive_mtime);
+
+/**
+ * Reads and checks the header of a sidecar file.
+ *
+ * @param in_fd A file descriptor opened for reading, positioned at the sidecar.
+ * @param magic The expected 8 bytes identifying the kind of sidecar.
+ * @param version The expected version of its layout.
+ * @param item_size Size in bytes of one of the items following the header.
+ * @param tar_fd The archive the sidecar is meant for, or -1 to skip the check.
+ * @param header Out argument, set to the header read.
+ *
+ * @return 0 if the items can be read, -1 otherwise: errno is EINVAL if the header is not
+ *         the expected one or its item count does not fit in memory or in the sidecar,
+ *         ESTALE if the sidecar was computed from a different version of the archive
+ *         (size or modification time changed).
+ *
+ * Note: The count is only checked against the size of in_fd when it is a regular file.
+ */
+int tar_sidecar_read(int in_fd, const char *magic, uint32_t version, size_t item_size, int tar_fd,
+                     tar_sidecar_header_t *header);
+
+#endif
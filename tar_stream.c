@@ -0,0 +1,195 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "tar_stream.h"
+
+/* Parser states */
+#define STATE_HEADER  0
+#define STATE_DATA    1
+#define STATE_PADDING 2
+#define STATE_STOPPED 3
+
+/**
+ * Prepares a streaming parser.
+ *
+ * @param stream The parser.
+ * @param callback Called for every event.
+ * @param arg Passed to callback.
+ */
+void tar_stream_init(tar_stream_t *stream, tar_stream_cb callback, void *arg) {
+    memset(stream, 0, sizeof(*stream));
+    stream->callback = callback;
+    stream->arg = arg;
+}
+
+static int stop(tar_stream_t *stream, int result) {
+    stream->state = STATE_STOPPED;
+    stream->result = result;
+    return result;
+}
+
+/* Moves to the state following the data of the current member */
+static void after_data(tar_stream_t *stream) {
+    if (stream->remaining > 0) stream->state = STATE_DATA;
+    else stream->state = stream->padding > 0 ? STATE_PADDING : STATE_HEADER;
+}
+
+/* Handles a complete header block, returns TAR_STREAM_MORE to go on */
+static int process_header(tar_stream_t *stream) {
+    tar_stream_event_t event;
+    memset(&event, 0, sizeof(event));
+    stream->header_fill = 0;
+    if (tar_is_zero_block(&stream->header)) {
+        if (++stream->zero_blocks < 2) return TAR_STREAM_MORE;
+        event.type = TAR_STREAM_END;
+        stream->callback(&event, stream->arg);
+        return stop(stream, TAR_STREAM_DONE);
+    }
+    stream->zero_blocks = 0;
+    // The checks of check_archive, done as soon as the block is complete
+    if (strncmp(stream->header.magic, TMAGIC, TMAGLEN) != 0) return stop(stream, -1);
+    if (strncmp(stream->header.version, TVERSION, TVERSLEN) != 0) return stop(stream, -2);
+    if (calculate_tar_checksum(&stream->header) != (unsigned int)TAR_INT(stream->header.chksum)) return stop(stream, -3);
+
+    int64_t size = TAR_INT(stream->header.size);
+    if (size < 0) return stop(stream, -4);
+    stream->remaining = (uint64_t)size;
+    stream->padding = (BLOCKSIZE - stream->remaining % BLOCKSIZE) % BLOCKSIZE;
+    stream->offset = 0;
+    stream->members++;
+    event.type = TAR_STREAM_HEADER;
+    event.header = &stream->header;
+    int action = stream->callback(&event, stream->arg);
+    if (action == TAR_STREAM_STOP) return stop(stream, TAR_STREAM_DONE);
+    stream->skipping = action == TAR_STREAM_SKIP;
+    after_data(stream);
+    return TAR_STREAM_MORE;
+}
+
+/**
+ * Pushes the next bytes of an archive into the parser.
+ *
+ * @param stream The parser.
+ * @param buf The next bytes of the archive, cut anywhere.
+ * @param len Their length.
+ *
+ * @return TAR_STREAM_MORE if more input is expected, TAR_STREAM_DONE if the archive ended or
+ *         the callback stopped the parser, or the check_archive error code of an invalid header.
+ */
+int tar_stream_feed(tar_stream_t *stream, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    while (len > 0) {
+        size_t n;
+        switch (stream->state) {
+            case STATE_HEADER:
+                n = BLOCKSIZE - stream->header_fill < len ? BLOCKSIZE - stream->header_fill : len;
+                memcpy((uint8_t *)&stream->header + stream->header_fill, p, n);
+                stream->header_fill += n;
+                if (stream->header_fill == BLOCKSIZE && process_header(stream) != TAR_STREAM_MORE) return stream->result;
+                break;
+            case STATE_DATA:
+                n = stream->remaining < len ? (size_t)stream->remaining : len;
+                if (!stream->skipping) {
+                    tar_stream_event_t event = {TAR_STREAM_DATA, &stream->header, p, n, stream->offset};
+                    int action = stream->callback(&event, stream->arg);
+                    if (action == TAR_STREAM_STOP) return stop(stream, TAR_STREAM_DONE);
+                    stream->skipping = action == TAR_STREAM_SKIP;
+                }
+                stream->offset += n;
+                stream->remaining -= n;
+                after_data(stream);
+                break;
+            case STATE_PADDING:
+                n = stream->padding < len ? (size_t)stream->padding : len;
+                stream->padding -= n;
+                after_data(stream);
+                break;
+            default:
+                return stream->result;
+        }
+        p += n;
+        len -= n;
+    }
+    return stream->state == STATE_STOPPED ? stream->result : TAR_STREAM_MORE;
+}
+
+/**
+ * Tells the parser that the input ended.
+ *
+ * @param stream The parser.
+ *
+ * @return The number of members seen, or TAR_STREAM_TRUNCATED if the input stopped inside a
+ *         member, or the error returned by tar_stream_feed.
+ */
+long tar_stream_finish(tar_stream_t *stream) {
+    if (stream->state == STATE_STOPPED) return stream->result < 0 ? stream->result : stream->members;
+    if (stream->state != STATE_HEADER || stream->header_fill != 0) return stop(stream, TAR_STREAM_TRUNCATED);
+    return stream->members;
+}
+
+/**
+ * Returns how many of the next input bytes the parser would drop without any event.
+ *
+ * @param stream The parser.
+ *
+ * @return The data and padding left in the member being skipped, zero otherwise.
+ */
+uint64_t tar_stream_skippable(const tar_stream_t *stream) {
+    if (stream->state != STATE_DATA || !stream->skipping) return 0;
+    return stream->remaining + stream->padding;
+}
+
+/**
+ * Tells the parser that input bytes were passed over instead of being fed.
+ *
+ * @param stream The parser.
+ * @param len The number of bytes, at most tar_stream_skippable.
+ */
+void tar_stream_skip(tar_stream_t *stream, uint64_t len) {
+    if (len > tar_stream_skippable(stream)) len = tar_stream_skippable(stream);
+    uint64_t data = len < stream->remaining ? len : stream->remaining;
+    stream->remaining -= data;
+    stream->offset += data;
+    stream->padding -= len - data;
+    after_data(stream);
+}
+
+/**
+ * Parses an archive read from a descriptor, in a single pass.
+ *
+ * @param fd The descriptor, read from its current position until the archive ends.
+ * @param callback Called for every event.
+ * @param arg Passed to callback.
+ *
+ * @return The number of members seen, or a negative value as tar_stream_finish,
+ *         or TAR_STREAM_EREAD.
+ */
+long tar_stream_fd(int fd, tar_stream_cb callback, void *arg) {
+    uint8_t *buffer = malloc(TAR_STREAM_BUFFER);
+    if (buffer == NULL) return TAR_STREAM_EREAD;
+    tar_stream_t stream;
+    tar_stream_init(&stream, callback, arg);
+    // Only regular files are jumped over: their size tells whether the member really is complete
+    struct stat st;
+    off_t position = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) ? lseek(fd, 0, SEEK_CUR) : -1;
+    int status = TAR_STREAM_MORE;
+    while (status == TAR_STREAM_MORE) {
+        // The whole buffer is always consumed, so a skipped member can be jumped over
+        off_t jump = (off_t)tar_stream_skippable(&stream);
+        if (position != -1 && jump > 0 && position + jump <= st.st_size && lseek(fd, position + jump, SEEK_SET) != -1) {
+            position += jump;
+            tar_stream_skip(&stream, (uint64_t)jump);
+        }
+        ssize_t n = read(fd, buffer, TAR_STREAM_BUFFER);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            free(buffer);
+            return TAR_STREAM_EREAD;
+        }
+        if (n == 0) break;
+        if (position != -1) position += n;
+        status = tar_stream_feed(&stream, buffer, (size_t)n);
+    }
+    free(buffer);
+    return tar_stream_finish(&stream);
+}
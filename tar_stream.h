@@ -0,0 +1,139 @@
+#ifndef TAR_STREAM_H
+#define TAR_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "lib_tar.h"
+
+/* Events */
+#define TAR_STREAM_HEADER 1       /* a member starts, header is set */
+#define TAR_STREAM_DATA   2       /* a piece of the member data, data/len/offset are set */
+#define TAR_STREAM_END    3       /* the end-of-archive blocks were reached */
+
+/* Callback return values */
+#define TAR_STREAM_CONTINUE 0
+#define TAR_STREAM_SKIP     1     /* drop the rest of the current member's data */
+#define TAR_STREAM_STOP     2     /* stop parsing */
+
+/* Return values of tar_stream_feed besides the check_archive error codes */
+#define TAR_STREAM_MORE 0         /* all the input was consumed, feed more */
+#define TAR_STREAM_DONE 1         /* the archive ended or the callback stopped the parser */
+#define TAR_STREAM_TRUNCATED -5   /* the input ended inside a member */
+#define TAR_STREAM_EREAD -6       /* reading the descriptor failed (errno is set) */
+
+/* Size of the reads of tar_stream_fd */
+#define TAR_STREAM_BUFFER (128 * 1024)
+
+typedef struct tar_stream_event
+{
+    int type;                     /* TAR_STREAM_HEADER, TAR_STREAM_DATA or TAR_STREAM_END */
+    const tar_header_t *header;   /* the current member, also set for data events */
+    const uint8_t *data;          /* points into the fed buffer, valid during the call only */
+    size_t len;
+    uint64_t offset;              /* offset of data from the start of the member data */
+} tar_stream_event_t;
+
+/**
+ * Callback of the streaming parser.
+ *
+ * @param event The event.
+ * @param arg The argument given to tar_stream_init.
+ *
+ * @return TAR_STREAM_CONTINUE, TAR_STREAM_SKIP (header and data events) or TAR_STREAM_STOP.
+ */
+typedef int (*tar_stream_cb)(const tar_stream_event_t *event, void *arg);
+
+typedef struct tar_stream
+{
+    int state;                    /* where the parser is in the current block sequence */
+    int result;                   /* sticky once the parser stopped */
+    tar_header_t header;          /* current header, assembled across feeds */
+    size_t header_fill;
+    uint64_t remaining;           /* data bytes left in the current member */
+    uint64_t padding;             /* padding bytes left after them */
+    uint64_t offset;              /* data bytes of the current member already seen */
+    int skipping;
+    int zero_blocks;              /* consecutive zero blocks seen */
+    long members;
+    tar_stream_cb callback;
+    void *arg;
+} tar_stream_t;
+
+/**
+ * Prepares a streaming parser. It keeps no more than one header of the input, so memory
+ * use does not depend on the archive.
+ *
+ * @param stream The parser.
+ * @param callback Called for every event.
+ * @param arg Passed to callback.
+ */
+void tar_stream_init(tar_stream_t *stream, tar_stream_cb callback, void *arg);
+
+/**
+ * Pushes the next bytes of an archive into the parser.
+ *
+ * Headers are validated as they complete, with the checks of check_archive. Data events
+ * point into buf; the data of skipped members is consumed without any event.
+ *
+ * @param stream The parser.
+ * @param buf The next bytes of the archive, cut anywhere.
+ * @param len Their length.
+ *
+ * @return TAR_STREAM_MORE if more input is expected,
+ *         TAR_STREAM_DONE if the archive ended or the callback stopped the parser,
+ *         -1 if a header has an invalid magic value,
+ *         -2 if a header has an invalid version value,
+ *         -3 if a header has an invalid checksum value,
+ *         -4 if a header has a negative size value.
+ *         Once it is not TAR_STREAM_MORE, the same value is returned for any further input.
+ */
+int tar_stream_feed(tar_stream_t *stream, const void *buf, size_t len);
+
+/**
+ * Tells the parser that the input ended.
+ *
+ * @param stream The parser.
+ *
+ * @return The number of members seen, or TAR_STREAM_TRUNCATED if the input stopped inside a
+ *         member, or the error returned by tar_stream_feed. Archives without end-of-archive
+ *         blocks are accepted.
+ */
+long tar_stream_finish(tar_stream_t *stream);
+
+/**
+ * Returns how many of the next input bytes the parser would drop without any event.
+ *
+ * @param stream The parser.
+ *
+ * @return The data and padding left in the member being skipped, zero otherwise.
+ *
+ * Note: A reader able to seek may jump over these bytes and call tar_stream_skip instead
+ *       of feeding them.
+ */
+uint64_t tar_stream_skippable(const tar_stream_t *stream);
+
+/**
+ * Tells the parser that input bytes were passed over instead of being fed.
+ *
+ * @param stream The parser.
+ * @param len The number of bytes, at most tar_stream_skippable.
+ */
+void tar_stream_skip(tar_stream_t *stream, uint64_t len);
+
+/**
+ * Parses an archive read from a descriptor, in a single pass.
+ *
+ * The descriptor may be a pipe or a socket. When it is seekable, the data of skipped members
+ * is passed over with lseek instead of being read.
+ *
+ * @param fd The descriptor, read from its current position until the archive ends.
+ * @param callback Called for every event.
+ * @param arg Passed to callback.
+ *
+ * @return The number of members seen, or a negative value as tar_stream_finish,
+ *         or TAR_STREAM_EREAD.
+ */
+long tar_stream_fd(int fd, tar_stream_cb callback, void *arg);
+
+#endif
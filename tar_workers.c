@@ -0,0 +1,37 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tar_workers.h"
+
+/**
+ * Runs the same worker on several threads and waits for all of them.
+ *
+ * @param nthreads Number of threads, 0 uses one per online CPU.
+ * @param max_threads Upper bound on the number of threads, e.g. the number of work units.
+ * @param worker The function run by every thread.
+ * @param arg Passed to every call of worker.
+ *
+ * @return The number of threads that ran the worker.
+ */
+unsigned int tar_run_workers(unsigned int nthreads, size_t max_threads, void *(*worker)(void *), void *arg) {
+    if (nthreads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = cpus > 0 ? (unsigned int)cpus : 1;
+    }
+    if (nthreads > max_threads) nthreads = max_threads ? (unsigned int)max_threads : 1;
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    unsigned int started = 0;
+    if (threads != NULL) {
+        for (; started < nthreads; ++started) {
+            if (pthread_create(&threads[started], NULL, worker, arg) != 0) break;
+        }
+    }
+    if (started == 0) {
+        worker(arg); // no thread could be started, work from the caller's thread
+        started = 1;
+    } else {
+        for (unsigned int i = 0; i < started; ++i) pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    return started;
+}
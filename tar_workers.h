@@ -0,0 +1,22 @@
+#ifndef TAR_WORKERS_H
+#define TAR_WORKERS_H
+
+#include <stddef.h>
+
+/**
+ * Runs the same worker on several threads and waits for all of them.
+ *
+ * The workers share arg and take their work from it, e.g. with an atomic counter.
+ *
+ * @param nthreads Number of threads, 0 uses one per online CPU.
+ * @param max_threads Upper bound on the number of threads, e.g. the number of work units.
+ * @param worker The function run by every thread.
+ * @param arg Passed to every call of worker.
+ *
+ * @return The number of threads that ran the worker.
+ *
+ * Note: If no thread can be started, the worker runs once on the caller's thread.
+ */
+unsigned int tar_run_workers(unsigned int nthreads, size_t max_threads, void *(*worker)(void *), void *arg);
+
+#endif
@@ -1,12 +1,32 @@
+#include <errno.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <pthread.h>
 #include <fcntl.h>
 #include "CUnit/Basic.h"
 #include "CUnit/Automated.h"
 #include "CUnit/CUnit.h"
 
 #include "lib_tar.h"
+#include "tar_bloom.h"
+#include "tar_cache.h"
+#include "tar_index.h"
+#include "tar_fcindex.h"
+#include "tar_search.h"
+#include "tar_diff.h"
+#include "tar_digest.h"
+#include "tar_overlay.h"
+#include "tar_shindex.h"
+#include "tar_async.h"
+#include "tar_stream.h"
+#include "tar_scan.h"
 
 /**
  * You are free to use this file to write tests for your implementation
@@ -29,6 +49,43 @@ void debug_dump(const uint8_t *bytes, size_t len) {
     }
 }
 
+/* Writes a ustar archive holding "big" (size pseudo-random bytes, returned in *content) then
+   "small" (10 bytes), returns a descriptor on it */
+static int make_big_archive(char *path, size_t size, uint8_t **content) {
+    tar_header_t template;
+    tar_header_t header;
+    if (pread(fd, &template, sizeof(template), 0) != sizeof(template)) return -1; // dir1/
+    *content = malloc(size ? size : 1);
+    int big_fd = mkstemp(path);
+    if (*content == NULL || big_fd == -1) return -1;
+    uint64_t x = 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; i < size; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        (*content)[i] = (uint8_t)x;
+    }
+    const char *names[2] = {"big", "small"};
+    size_t sizes[2] = {size, 10};
+    off_t position = 0;
+    for (int i = 0; i < 2; ++i) {
+        header = template;
+        memset(header.name, 0, sizeof(header.name));
+        strcpy(header.name, names[i]);
+        header.typeflag = REGTYPE;
+        snprintf(header.size, sizeof(header.size), "%011zo", sizes[i]);
+        snprintf(header.chksum, sizeof(header.chksum), "%06o", calculate_tar_checksum(&header));
+        header.chksum[7] = ' ';
+        if (pwrite(big_fd, &header, sizeof(header), position) != sizeof(header)) return -1;
+        position += BLOCKSIZE;
+        if (pwrite(big_fd, *content, sizes[i], position) != (ssize_t)sizes[i]) return -1;
+        position += ((sizes[i] + BLOCKSIZE - 1) / BLOCKSIZE) * BLOCKSIZE;
+    }
+    // Two zero blocks end the archive
+    if (ftruncate(big_fd, position + 2 * BLOCKSIZE) == -1) return -1;
+    return big_fd;
+}
+
 int init_suite(void) {
     fd = open("./tars/archive.tar", O_RDONLY);
     if (fd == -1) {
@@ -72,7 +129,50 @@ void test_is_file(void);
 void test_is_symlink(void);
 void test_list(void);
 void test_read_file(void);
+void test_decode_number(void);
+void test_negative_size(void);
+void test_read_file_content(void);
+void test_read_file_cached(void);
+void test_index(void);
+void test_send_entry(void);
+void test_fcindex(void);
+void test_search(void);
+void test_diff(void);
+void test_digest(void);
+void test_overlay(void);
+void test_shindex(void);
+void test_read_file_v(void);
+void test_async(void);
+void test_stream(void);
+void test_scan(void);
+void test_served(void);
+void test_query(void);
+void test_bloom(void);
+
 
+void test_decode_number(void){
+    // Octal, NUL- and space-terminated, and with leading spaces
+    CU_ASSERT_EQUAL(tar_decode_number("00000001130\0", 12), 600);
+    CU_ASSERT_EQUAL(tar_decode_number("  1130 \0", 8), 600);
+    // A field filled up to its width without any terminator
+    CU_ASSERT_EQUAL(tar_decode_number("777777777777", 12), 68719476735LL);
+    CU_ASSERT_EQUAL(tar_decode_number("", 1), 0);
+
+    // Base-256: 16 GiB does not fit in the 11 octal digits of the size field
+    char size[12] = {0};
+    size[0] = (char)0x80;
+    size[7] = 0x04;
+    CU_ASSERT_EQUAL(tar_decode_number(size, sizeof(size)), (int64_t)16 << 30);
+    char negative[8];
+    memset(negative, 0xff, sizeof(negative));
+    CU_ASSERT_EQUAL(tar_decode_number(negative, sizeof(negative)), -1);
+
+    // The real archive still decodes the same way
+    tar_header_t header;
+    go_back_start(fd);
+    CU_ASSERT_TRUE(get_header_type(fd, "fichier1", &header));
+    CU_ASSERT_EQUAL(TAR_INT(header.size), 603);
+}
 
 void test_check_archive(void){
     CU_ASSERT_EQUAL(check_archive(fd),13)
@@ -105,6 +205,49 @@ void test_exists(void) {
     CU_ASSERT_FALSE(exists(fd, "dir1/link_to_nonexistent_file"));
 }
 
+void test_bloom(void){
+    tar_bloom_t *bloom = tar_bloom_build(fd, 0.01);
+    CU_ASSERT_PTR_NOT_NULL(bloom);
+    if (bloom == NULL) return;
+    CU_ASSERT_TRUE(tar_bloom_may_contain(bloom, "fichier1"));
+    CU_ASSERT_TRUE(tar_bloom_may_contain(bloom, "dir2/dir3/dir4/link_to_file5"));
+
+    // Lookups go through the filter once attached, without changing the answers
+    CU_ASSERT_EQUAL(tar_bloom_attach(fd, bloom), 0);
+    CU_ASSERT_TRUE(exists(fd, "dir2/dir3/"));
+    CU_ASSERT_TRUE(is_file(fd, "dir2/file3"));
+    CU_ASSERT_FALSE(exists(fd, "nonexistent_file.txt"));
+    CU_ASSERT_FALSE(exists(fd, "dir1/nonexistent_directory/"));
+
+    // Round trip through a sidecar file
+    FILE *sidecar = tmpfile();
+    CU_ASSERT_EQUAL(tar_bloom_save(bloom, fileno(sidecar)), 0);
+    lseek(fileno(sidecar), 0, SEEK_SET);
+    tar_bloom_t *loaded = tar_bloom_load(fileno(sidecar), fd);
+    CU_ASSERT_PTR_NOT_NULL(loaded);
+    if (loaded != NULL) {
+        CU_ASSERT_EQUAL(loaded->nblocks, bloom->nblocks);
+        CU_ASSERT_TRUE(tar_bloom_may_contain(loaded, "link_to_link_to_file_5"));
+    }
+    // A filter saved for another archive is refused
+    lseek(fileno(sidecar), 0, SEEK_SET);
+    CU_ASSERT_PTR_NULL(tar_bloom_load(fileno(sidecar), fd_empty));
+    CU_ASSERT_EQUAL(errno, ESTALE);
+    // So is a header whose block count is zero, overflows or does not match the sidecar size
+    uint64_t bad_counts[] = {0, SIZE_MAX / 8, bloom->nblocks + 1};
+    for (size_t i = 0; i < sizeof(bad_counts) / sizeof(bad_counts[0]); ++i) {
+        CU_ASSERT_EQUAL(pwrite(fileno(sidecar), &bad_counts[i], sizeof(uint64_t), 16), sizeof(uint64_t));
+        lseek(fileno(sidecar), 0, SEEK_SET);
+        CU_ASSERT_PTR_NULL(tar_bloom_load(fileno(sidecar), -1));
+        CU_ASSERT_EQUAL(errno, EINVAL);
+    }
+    fclose(sidecar);
+
+    CU_ASSERT_EQUAL(tar_bloom_attach(fd, NULL), 0);
+    tar_bloom_free(loaded);
+    tar_bloom_free(bloom);
+}
+
 void test_is_dir(void){
     // Test case: Directory exists
     CU_ASSERT_TRUE(is_dir(fd, "dir1/"));
@@ -207,6 +350,1075 @@ void test_read_file(void){
 
 }
 
+void test_read_file_content(void){
+    uint8_t expected[33712];
+    uint8_t res[33712];
+    int ref = open("./tars/achive1/dir2/dir3/dir4/file5", O_RDONLY);
+    CU_ASSERT_EQUAL(read(ref, expected, sizeof(expected)), sizeof(expected));
+    close(ref);
+
+    size_t len = sizeof(res);
+    CU_ASSERT_EQUAL(read_file(fd, "dir2/dir3/dir4/file5", 0, res, &len), 0);
+    CU_ASSERT_EQUAL(len, sizeof(expected));
+    CU_ASSERT_EQUAL(memcmp(res, expected, sizeof(expected)), 0);
+
+    // Partial read from an offset, through a symlink
+    len = 100;
+    CU_ASSERT_EQUAL(read_file(fd, "dir2/dir3/dir4/link_to_file5", 1000, res, &len), sizeof(expected) - 1100);
+    CU_ASSERT_EQUAL(len, 100);
+    CU_ASSERT_EQUAL(memcmp(res, expected + 1000, 100), 0);
+
+    len = sizeof(res);
+    CU_ASSERT_EQUAL(read_file(fd, "fichier2", 1, res, &len), -2);
+    CU_ASSERT_EQUAL(read_file(fd, "dir2/", 0, res, &len), -1);
+}
+
+void test_read_file_cached(void){
+    // Room for 4 chunks only, so scanning the 50 KiB archive has to evict
+    tar_cache_t *cache = tar_cache_new(4 * TAR_CACHE_CHUNK, 2);
+    CU_ASSERT_PTR_NOT_NULL(cache);
+    if (cache == NULL) return;
+    CU_ASSERT_EQUAL(tar_cache_attach(fd, cache), 0);
+
+    uint8_t first[603], second[603];
+    size_t len = sizeof(first);
+    CU_ASSERT_EQUAL(read_file(fd, "fichier1", 0, first, &len), 0);
+    CU_ASSERT_EQUAL(len, sizeof(first));
+    tar_cache_stats_t before;
+    tar_cache_get_stats(cache, &before);
+    CU_ASSERT_TRUE(before.misses > 0);
+
+    len = sizeof(second);
+    CU_ASSERT_EQUAL(read_file(fd, "fichier1", 0, second, &len), 0);
+    CU_ASSERT_EQUAL(memcmp(first, second, sizeof(first)), 0);
+    tar_cache_stats_t after;
+    tar_cache_get_stats(cache, &after);
+    CU_ASSERT_TRUE(after.hits > before.hits);
+    CU_ASSERT_TRUE(after.evictions > 0);
+
+    // Header scans through the cache see the same archive, without moving the file offset
+    off_t offset = lseek(fd, 12345, SEEK_SET);
+    CU_ASSERT_EQUAL(check_archive(fd), 13);
+    CU_ASSERT_TRUE(is_symlink(fd, "dir1/link_to_dir4"));
+    CU_ASSERT_EQUAL(lseek(fd, 0, SEEK_CUR), offset);
+    CU_ASSERT_EQUAL(tar_cache_revalidate(fd), 0);
+
+    // seek_to_file_data moves the cached position, which the next header read starts from
+    tar_header_t header;
+    CU_ASSERT_TRUE(get_header_type(fd, "fichier1", &header));
+    go_back_start(fd);
+    CU_ASSERT_EQUAL(seek_to_file_data(fd, &header, 0), 0);
+    CU_ASSERT_EQUAL(tar_cache_tell(fd), 2 * BLOCKSIZE + BLOCKSIZE);
+    CU_ASSERT_EQUAL(lseek(fd, 0, SEEK_CUR), offset);
+
+    CU_ASSERT_EQUAL(tar_cache_attach(fd, NULL), 0);
+    CU_ASSERT_EQUAL(tar_cache_tell(fd), -1);
+    CU_ASSERT_EQUAL(tar_cache_revalidate(fd), -1);
+
+    // An archive rewritten in place is noticed through its size and modification time
+    static uint8_t archive[51200];
+    char path[] = "/tmp/tar_cached_XXXXXX";
+    int copy_fd = mkstemp(path);
+    CU_ASSERT_EQUAL(pread(fd, archive, sizeof(archive), 0), sizeof(archive));
+    CU_ASSERT_EQUAL(write(copy_fd, archive, sizeof(archive)), sizeof(archive));
+    CU_ASSERT_EQUAL(tar_cache_attach(copy_fd, cache), 0);
+    len = sizeof(first);
+    CU_ASSERT_EQUAL(read_file(copy_fd, "fichier1", 0, first, &len), 0);
+    off_t data_offset, size;
+    CU_ASSERT_EQUAL(tar_locate_file(copy_fd, "fichier1", &data_offset, &size), 0);
+    CU_ASSERT_EQUAL(pwrite(copy_fd, "REWRITTEN", 9, data_offset), 9);
+    struct timespec times[2] = {{0, UTIME_OMIT}, {1000000000, 0}};
+    CU_ASSERT_EQUAL(futimens(copy_fd, times), 0);
+    len = sizeof(second);
+    CU_ASSERT_EQUAL(read_file(copy_fd, "fichier1", 0, second, &len), 0);
+    CU_ASSERT_EQUAL(memcmp(second, "REWRITTEN", 9), 0);
+    CU_ASSERT_EQUAL(memcmp(first + 9, second + 9, sizeof(first) - 9), 0);
+    CU_ASSERT_EQUAL(tar_cache_attach(copy_fd, NULL), 0);
+    close(copy_fd);
+    unlink(path);
+
+    tar_cache_free(cache);
+}
+
+void test_index(void){
+    tar_index_t *index = tar_index_build(fd);
+    CU_ASSERT_PTR_NOT_NULL(index);
+    if (index == NULL) return;
+    CU_ASSERT_EQUAL(index->count, 13);
+    CU_ASSERT_FALSE(tar_index_is_stale(index, fd));
+
+    const tar_entry_t *entry = tar_index_lookup(index, "dir2/file3");
+    CU_ASSERT_PTR_NOT_NULL(entry);
+    CU_ASSERT_EQUAL(tar_entry_type(entry), 1);
+    CU_ASSERT_EQUAL(entry->size, 1);
+    CU_ASSERT_PTR_NULL(tar_index_lookup(index, "nonexistent_file.txt"));
+    CU_ASSERT_EQUAL(tar_entry_type(tar_index_lookup(index, "dir1/link_to_dir4")), 3);
+
+    // Links are followed, including the "./" prefixed chain link -> link -> file
+    entry = tar_index_resolve(index, "link_to_link_to_file_5");
+    CU_ASSERT_PTR_NOT_NULL(entry);
+    if (entry != NULL) CU_ASSERT_STRING_EQUAL(entry->name, "dir2/dir3/dir4/file5");
+    CU_ASSERT_PTR_NULL(tar_index_resolve(index, "dir2/dir3/brokenlink1"));
+
+    char buffers[8][MAX_PATH_SIZE + 1];
+    char *entries[8];
+    for (int i = 0; i < 8; ++i) entries[i] = buffers[i];
+    size_t no_entries = 8;
+    CU_ASSERT_NOT_EQUAL(tar_index_list(index, "dir1/link_to_dir4", entries, &no_entries), 0);
+    CU_ASSERT_EQUAL(no_entries, 2);
+    CU_ASSERT_STRING_EQUAL(entries[0], "dir2/dir3/dir4/link_to_file5");
+    CU_ASSERT_STRING_EQUAL(entries[1], "dir2/dir3/dir4/file5");
+    no_entries = 8;
+    CU_ASSERT_EQUAL(tar_index_list(index, "fichier1", entries, &no_entries), 0);
+    CU_ASSERT_EQUAL(no_entries, 0);
+
+    uint8_t res[16];
+    size_t len = 5;
+    CU_ASSERT_EQUAL(tar_index_read(index, fd, "link_to_link_to_file_5", 0, res, &len), 33707);
+    CU_ASSERT_EQUAL(len, 5);
+    CU_ASSERT_EQUAL(memcmp(res, "Lorem", 5), 0);
+    len = sizeof(res);
+    CU_ASSERT_EQUAL(tar_index_read(index, fd, "fichier2", 1, res, &len), -2);
+    len = sizeof(res);
+    CU_ASSERT_EQUAL(tar_index_read(index, fd, "fichier1", SIZE_MAX, res, &len), -2);
+    CU_ASSERT_EQUAL(len, 0);
+    CU_ASSERT_EQUAL(tar_index_read(index, fd, "dir2/", 0, res, &len), -1);
+    tar_index_free(index);
+}
+
+void test_send_entry(void){
+    uint8_t expected[603], res[603];
+    int ref = open("./tars/achive1/fichier1", O_RDONLY);
+    CU_ASSERT_EQUAL(read(ref, expected, sizeof(expected)), sizeof(expected));
+    close(ref);
+
+    // To a regular file
+    FILE *out = tmpfile();
+    size_t len = 1000;
+    CU_ASSERT_EQUAL(tar_send_entry(fd, "fichier1", 0, &len, fileno(out)), 0);
+    CU_ASSERT_EQUAL(len, sizeof(expected));
+    CU_ASSERT_EQUAL(pread(fileno(out), res, sizeof(res), 0), sizeof(res));
+    CU_ASSERT_EQUAL(memcmp(res, expected, sizeof(expected)), 0);
+    fclose(out);
+
+    // To a pipe, partially, through the "./" prefixed chain of symlinks
+    int pipefd[2];
+    CU_ASSERT_EQUAL(pipe(pipefd), 0);
+    len = 5;
+    CU_ASSERT_EQUAL(tar_send_entry(fd, "link_to_link_to_file_5", 0, &len, pipefd[1]), 33707);
+    CU_ASSERT_EQUAL(len, 5);
+    CU_ASSERT_EQUAL(read(pipefd[0], res, 5), 5);
+    CU_ASSERT_EQUAL(memcmp(res, "Lorem", 5), 0);
+    close(pipefd[0]);
+    close(pipefd[1]);
+
+    len = 10;
+    CU_ASSERT_EQUAL(tar_send_entry(fd, "dir1/", 0, &len, 1), -1);
+    CU_ASSERT_EQUAL(tar_send_entry(fd, "fichier2", 1, &len, 1), -2);
+    CU_ASSERT_EQUAL(len, 0);
+}
+
+static int count_visits(const char *name, const tar_fc_entry_t *entry, void *arg) {
+    (*(int *)arg)++;
+    return 0;
+}
+
+void test_fcindex(void){
+    tar_fcindex_t *index = tar_fcindex_build(fd);
+    CU_ASSERT_PTR_NOT_NULL(index);
+    if (index == NULL) return;
+    CU_ASSERT_EQUAL(index->count, 13);
+
+    // Every name of the archive is found, and decodes back to itself
+    tar_header_t header;
+    char name[MAX_PATH_SIZE + 1];
+    go_back_start(fd);
+    while (next_header(fd, &header) > 0) {
+        const tar_fc_entry_t *entry = tar_fcindex_lookup(index, header.name);
+        CU_ASSERT_PTR_NOT_NULL(entry);
+        if (entry == NULL) continue;
+        CU_ASSERT_EQUAL(entry->size, TAR_INT(header.size));
+        tar_fcindex_name(index, entry, name);
+        CU_ASSERT_STRING_EQUAL(name, header.name);
+    }
+    CU_ASSERT_PTR_NULL(tar_fcindex_lookup(index, "dir2/dir3/dir4/file"));
+    CU_ASSERT_PTR_NULL(tar_fcindex_lookup(index, "zzz"));
+    CU_ASSERT_PTR_NULL(tar_fcindex_lookup(index, "a"));
+
+    const tar_fc_entry_t *entry = tar_fcindex_resolve(index, "link_to_link_to_file_5");
+    CU_ASSERT_PTR_NOT_NULL(entry);
+    if (entry != NULL) CU_ASSERT_EQUAL(entry->size, 33712);
+    CU_ASSERT_STRING_EQUAL(tar_fcindex_linkname(index, tar_fcindex_lookup(index, "dir1/link_to_dir4")), "dir2/dir3/dir4/");
+
+    // dir2/ holds itself, file3, dir3/, brokenlink1, dir4/, link_to_file5 and file5
+    int visits = 0;
+    CU_ASSERT_EQUAL(tar_fcindex_foreach_prefix(index, "dir2/", count_visits, &visits), 7);
+    CU_ASSERT_EQUAL(visits, 7);
+
+    char buffers[8][MAX_PATH_SIZE + 1];
+    char *entries[8];
+    for (int i = 0; i < 8; ++i) entries[i] = buffers[i];
+    size_t no_entries = 8;
+    CU_ASSERT_NOT_EQUAL(tar_fcindex_list(index, "dir2/", entries, &no_entries), 0);
+    CU_ASSERT_EQUAL(no_entries, 2);
+    CU_ASSERT_STRING_EQUAL(entries[0], "dir2/file3");
+    CU_ASSERT_STRING_EQUAL(entries[1], "dir2/dir3/");
+    no_entries = 8;
+    CU_ASSERT_NOT_EQUAL(tar_fcindex_list(index, "dir1/link_to_dir4", entries, &no_entries), 0);
+    CU_ASSERT_EQUAL(no_entries, 2);
+    no_entries = 8;
+    CU_ASSERT_EQUAL(tar_fcindex_list(index, "fichier1", entries, &no_entries), 0);
+
+    CU_ASSERT_TRUE(tar_fcindex_memory(index) < 13 * sizeof(tar_entry_t));
+    tar_fcindex_free(index);
+}
+
+struct search_result {
+    int matches;
+    int in_fichier1;
+    uint64_t first_offset;
+};
+
+static int record_match(const char *path, uint64_t offset, void *arg) {
+    struct search_result *result = arg;
+    if (strcmp(path, "fichier1") == 0) result->in_fichier1++;
+    if (result->matches++ == 0 || offset < result->first_offset) result->first_offset = offset;
+    return 0;
+}
+
+static int stop_at_first(const char *path, uint64_t offset, void *arg) {
+    return 1;
+}
+
+void test_search(void){
+    const uint8_t haystack[] = "0123456789abcdef0123456789abcdefneedle";
+    CU_ASSERT_EQUAL(tar_memmem(haystack, sizeof(haystack) - 1, (const uint8_t *)"needle", 6), haystack + 32);
+    CU_ASSERT_PTR_NULL(tar_memmem(haystack, sizeof(haystack) - 1, (const uint8_t *)"needles", 7));
+
+    struct search_result result = {0, 0, 0};
+    CU_ASSERT_EQUAL(tar_search(fd, "ipsum", 0, 4, record_match, &result), 40);
+    CU_ASSERT_EQUAL(result.matches, 40);
+    CU_ASSERT_EQUAL(result.first_offset, 6);
+
+    memset(&result, 0, sizeof(result));
+    CU_ASSERT_EQUAL(tar_search(fd, "e", 0, 2, record_match, &result), 3165 + 24);
+    CU_ASSERT_EQUAL(result.in_fichier1, 24);
+
+    memset(&result, 0, sizeof(result));
+    CU_ASSERT_EQUAL(tar_search(fd, "e", TAR_SEARCH_FIRST_ONLY, 0, record_match, &result), 2);
+    CU_ASSERT_EQUAL(tar_search(fd, "e", 0, 0, stop_at_first, NULL), 1);
+    CU_ASSERT_EQUAL(tar_search(fd, "no such text", 0, 0, record_match, &result), 0);
+    CU_ASSERT_EQUAL(tar_search(fd, "", 0, 0, record_match, &result), -1);
+}
+
+struct diff_result {
+    int removed, added, changed, last_changes;
+    char last_path[101];
+};
+
+static int record_diff(const tar_diff_entry_t *diff, void *arg) {
+    struct diff_result *result = arg;
+    if (diff->kind == TAR_DIFF_REMOVED) result->removed++;
+    else if (diff->kind == TAR_DIFF_ADDED) result->added++;
+    else result->changed++;
+    result->last_changes = diff->changes;
+    strcpy(result->last_path, diff->path);
+    return 0;
+}
+
+void test_diff(void){
+    int empty = open("./tars/empty.tar", O_RDONLY);
+    struct diff_result result;
+    memset(&result, 0, sizeof(result));
+    CU_ASSERT_EQUAL(tar_diff(fd, fd, 0, 2, record_diff, &result), 0);
+    CU_ASSERT_EQUAL(tar_diff(fd, empty, 0, 2, record_diff, &result), 13);
+    CU_ASSERT_EQUAL(result.removed, 13);
+    CU_ASSERT_EQUAL(tar_diff(empty, fd, 0, 2, record_diff, &result), 13);
+    CU_ASSERT_EQUAL(result.added, 13);
+    close(empty);
+
+    // Copy of the archive with one byte of file5 changed, the headers are untouched
+    char copy_path[] = "/tmp/tar_diff_XXXXXX";
+    int copy = mkstemp(copy_path);
+    struct stat st;
+    fstat(fd, &st);
+    uint8_t *bytes = malloc(st.st_size);
+    CU_ASSERT_EQUAL(pread(fd, bytes, st.st_size, 0), st.st_size);
+    tar_index_t *index = tar_index_build(fd);
+    const tar_entry_t *file5 = tar_index_lookup(index, "dir2/dir3/dir4/file5");
+    bytes[file5->data_offset + 30000] ^= 1;
+    CU_ASSERT_EQUAL(write(copy, bytes, st.st_size), st.st_size);
+    tar_index_free(index);
+    free(bytes);
+
+    memset(&result, 0, sizeof(result));
+    CU_ASSERT_EQUAL(tar_diff(fd, copy, 0, 4, record_diff, &result), 1);
+    CU_ASSERT_EQUAL(result.changed, 1);
+    CU_ASSERT_EQUAL(result.last_changes, TAR_CHANGED_CONTENT);
+    CU_ASSERT_STRING_EQUAL(result.last_path, "dir2/dir3/dir4/file5");
+    CU_ASSERT_EQUAL(tar_diff(fd, copy, TAR_DIFF_TRUST_MTIME, 4, record_diff, &result), 0);
+    close(copy);
+    unlink(copy_path);
+}
+
+struct digest_result {
+    int count;
+    uint64_t file5;
+};
+
+static int record_digest(const char *path, uint64_t digest, void *arg) {
+    struct digest_result *result = arg;
+    result->count++;
+    if (strcmp(path, "dir2/dir3/dir4/file5") == 0) result->file5 = digest;
+    return 0;
+}
+
+void test_digest(void){
+    CU_ASSERT_EQUAL(tar_crc32c(0, "123456789", 9), 0xE3069283);
+    CU_ASSERT_EQUAL(tar_crc32c_combine(tar_crc32c(0, "1234", 4), tar_crc32c(0, "56789", 5), 5), 0xE3069283);
+    CU_ASSERT_EQUAL(tar_xxh64("", 0, 0), 0xEF46DB3751D8E999ULL);
+    CU_ASSERT_EQUAL(tar_xxh64("abc", 3, 0), 0x44BC2CF5AD770999ULL);
+
+    uint8_t expected[33712];
+    int ref = open("./tars/achive1/dir2/dir3/dir4/file5", O_RDONLY);
+    CU_ASSERT_EQUAL(read(ref, expected, sizeof(expected)), sizeof(expected));
+    close(ref);
+
+    struct digest_result result = {0, 0};
+    CU_ASSERT_EQUAL(tar_digest_all(fd, TAR_DIGEST_CRC32C, 2, record_digest, &result), 5);
+    CU_ASSERT_EQUAL(result.count, 5);
+    CU_ASSERT_EQUAL(result.file5, tar_crc32c(0, expected, sizeof(expected)));
+    CU_ASSERT_EQUAL(tar_digest_all(fd, TAR_DIGEST_XXH64, 0, record_digest, &result), 5);
+    CU_ASSERT_EQUAL(result.file5, tar_xxh64(expected, sizeof(expected), 0));
+    CU_ASSERT_EQUAL(tar_digest_all(fd, 42, 0, record_digest, &result), -1);
+
+    // Round trip through a sidecar file
+    tar_digests_t *digests = tar_digests_build(fd, TAR_DIGEST_XXH64, 0);
+    CU_ASSERT_PTR_NOT_NULL(digests);
+    char sidecar_path[] = "/tmp/tar_digest_XXXXXX";
+    int sidecar = mkstemp(sidecar_path);
+    CU_ASSERT_EQUAL(tar_digests_save(digests, sidecar), 0);
+    lseek(sidecar, 0, SEEK_SET);
+    tar_digests_t *loaded = tar_digests_load(sidecar, fd);
+    CU_ASSERT_PTR_NOT_NULL(loaded);
+    tar_index_t *index = tar_index_build(fd);
+    const tar_entry_t *file5 = tar_index_lookup(index, "dir2/dir3/dir4/file5");
+    const tar_digest_record_t *record = tar_digests_find(loaded, file5->data_offset);
+    CU_ASSERT_PTR_NOT_NULL(record);
+    CU_ASSERT_EQUAL(record->digest, result.file5);
+    CU_ASSERT_PTR_NULL(tar_digests_find(loaded, file5->header_offset));
+    tar_index_free(index);
+    tar_digests_free(loaded);
+    tar_digests_free(digests);
+    // A sidecar whose record count does not match its size is refused
+    uint64_t bad_count = 1000;
+    CU_ASSERT_EQUAL(pwrite(sidecar, &bad_count, sizeof(bad_count), 16), sizeof(bad_count));
+    lseek(sidecar, 0, SEEK_SET);
+    CU_ASSERT_PTR_NULL(tar_digests_load(sidecar, -1));
+    CU_ASSERT_EQUAL(errno, EINVAL);
+    close(sidecar);
+    unlink(sidecar_path);
+
+    // A member split in several TAR_DIGEST_CHUNK pieces gets the CRC of a single pass
+    char big_path[] = "/tmp/tar_big_XXXXXX";
+    size_t big_size = 2 * TAR_DIGEST_CHUNK + 12345;
+    uint8_t *content = NULL;
+    int big_fd = make_big_archive(big_path, big_size, &content);
+    CU_ASSERT_NOT_EQUAL(big_fd, -1);
+    tar_digests_t *big = tar_digests_build(big_fd, TAR_DIGEST_CRC32C, 3);
+    CU_ASSERT_PTR_NOT_NULL(big);
+    if (big != NULL) {
+        CU_ASSERT_EQUAL(big->count, 2);
+        const tar_digest_record_t *whole = tar_digests_find(big, BLOCKSIZE);
+        CU_ASSERT_PTR_NOT_NULL(whole);
+        if (whole != NULL) CU_ASSERT_EQUAL(whole->digest, tar_crc32c(0, content, big_size));
+    }
+    tar_digests_free(big);
+    free(content);
+    close(big_fd);
+    unlink(big_path);
+}
+
+void test_overlay(void){
+    // layer1.tar patches fichier1, whites out fichier2, makes dir2 opaque with a new file and adds a file
+    int fds[2] = {fd, open("./tars/layer1.tar", O_RDONLY)};
+    tar_overlay_t *overlay = tar_overlay_open(fds, 2);
+    CU_ASSERT_PTR_NOT_NULL(overlay);
+
+    CU_ASSERT_NOT_EQUAL(tar_overlay_exists(overlay, "added"), 0);
+    CU_ASSERT_NOT_EQUAL(tar_overlay_exists(overlay, "dir1/file4"), 0);
+    CU_ASSERT_NOT_EQUAL(tar_overlay_exists(overlay, "dir2/"), 0);
+    CU_ASSERT_EQUAL(tar_overlay_exists(overlay, "fichier2"), 0);
+    CU_ASSERT_EQUAL(tar_overlay_exists(overlay, ".wh.fichier2"), 0);
+    CU_ASSERT_EQUAL(tar_overlay_exists(overlay, "dir2/file3"), 0);
+    CU_ASSERT_EQUAL(tar_overlay_exists(overlay, "dir2/dir3/dir4/file5"), 0);
+    CU_ASSERT_EQUAL(tar_overlay_lookup(overlay, "fichier1")->layer, 1);
+    CU_ASSERT_EQUAL(tar_overlay_lookup(overlay, "dir1/file4")->layer, 0);
+
+    char buffer[64];
+    size_t len = sizeof(buffer);
+    CU_ASSERT_EQUAL(tar_overlay_read_file(overlay, "fichier1", 0, (uint8_t *)buffer, &len), 0);
+    CU_ASSERT_EQUAL(len, 8);
+    CU_ASSERT_NSTRING_EQUAL(buffer, "patched\n", 8);
+    len = sizeof(buffer);
+    CU_ASSERT_EQUAL(tar_overlay_read_file(overlay, "link_to_link_to_file_5", 0, (uint8_t *)buffer, &len), -1);
+    len = sizeof(buffer);
+    CU_ASSERT_EQUAL(tar_overlay_read_file(overlay, "added", 10, (uint8_t *)buffer, &len), -2);
+
+    char storage[4][MAX_PATH_SIZE + 1];
+    char *entries[4] = {storage[0], storage[1], storage[2], storage[3]};
+    size_t no_entries = 4;
+    CU_ASSERT_NOT_EQUAL(tar_overlay_list(overlay, "dir2/", entries, &no_entries), 0);
+    CU_ASSERT_EQUAL(no_entries, 1);
+    CU_ASSERT_STRING_EQUAL(entries[0], "dir2/new");
+    no_entries = 4;
+    CU_ASSERT_NOT_EQUAL(tar_overlay_list(overlay, "dir1/", entries, &no_entries), 0);
+    CU_ASSERT_EQUAL(no_entries, 2);
+    no_entries = 4;
+    CU_ASSERT_EQUAL(tar_overlay_list(overlay, "dir1/link_to_dir4", entries, &no_entries), 0);
+
+    tar_overlay_free(overlay);
+    close(fds[1]);
+
+    // A whiteout with an empty name hides nothing
+    tar_header_t layer[4];
+    memset(layer, 0, sizeof(layer));
+    const char *whiteouts[2] = {".wh.", "dir2/.wh."};
+    for (int i = 0; i < 2; ++i) {
+        CU_ASSERT_EQUAL(pread(fd, &layer[i], BLOCKSIZE, 0), BLOCKSIZE);
+        memset(layer[i].name, 0, sizeof(layer[i].name));
+        strcpy(layer[i].name, whiteouts[i]);
+        layer[i].typeflag = REGTYPE;
+        snprintf(layer[i].chksum, sizeof(layer[i].chksum), "%06o", calculate_tar_checksum(&layer[i]));
+        layer[i].chksum[7] = ' ';
+    }
+    char path[] = "/tmp/tar_layer_XXXXXX";
+    fds[1] = mkstemp(path);
+    CU_ASSERT_EQUAL(write(fds[1], layer, sizeof(layer)), sizeof(layer));
+    overlay = tar_overlay_open(fds, 2);
+    CU_ASSERT_PTR_NOT_NULL(overlay);
+    if (overlay != NULL) {
+        CU_ASSERT_NOT_EQUAL(tar_overlay_exists(overlay, "fichier1"), 0);
+        CU_ASSERT_NOT_EQUAL(tar_overlay_exists(overlay, "dir2/file3"), 0);
+        CU_ASSERT_NOT_EQUAL(tar_overlay_exists(overlay, "dir2/dir3/dir4/file5"), 0);
+        CU_ASSERT_EQUAL(tar_overlay_exists(overlay, ".wh."), 0);
+        CU_ASSERT_EQUAL(tar_overlay_exists(overlay, "dir2/.wh."), 0);
+    }
+    tar_overlay_free(overlay);
+    close(fds[1]);
+    unlink(path);
+}
+
+void test_shindex(void){
+    char name[64];
+    snprintf(name, sizeof(name), "/tar_tests_%d", (int)getpid());
+    tar_shindex_unlink(name);
+    tar_shindex_t *builder = tar_shindex_open(name, fd);
+    CU_ASSERT_PTR_NOT_NULL(builder);
+    CU_ASSERT_EQUAL(builder->index.count, 13);
+
+    // Another process attaches the published index instead of building its own
+    pid_t child = fork();
+    if (child == 0) {
+        tar_shindex_t *worker = tar_shindex_open(name, fd);
+        uint8_t buffer[5];
+        size_t len = sizeof(buffer);
+        int ok = worker != NULL && tar_index_lookup(&worker->index, "fichier1") != NULL
+                 && tar_index_read(&worker->index, fd, "link_to_link_to_file_5", 0, buffer, &len) == 33712 - 5
+                 && memcmp(buffer, "Lorem", 5) == 0;
+        _exit(ok ? 0 : 1);
+    }
+    int status = -1;
+    waitpid(child, &status, 0);
+    CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    tar_shindex_detach(builder);
+    CU_ASSERT_EQUAL(tar_shindex_unlink(name), 0);
+
+    // A builder that dies before publishing leaves its pid behind, a waiter takes over
+    struct tar_shindex_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "TARSHIX2", sizeof(header.magic));
+    header.sequence = 1;
+    child = fork();
+    if (child == 0) {
+        int shm_fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+        header.builder_pid = getpid();
+        int ok = shm_fd != -1 && pwrite(shm_fd, &header, sizeof(header), 0) == sizeof(header);
+        _exit(ok ? 0 : 1);
+    }
+    waitpid(child, &status, 0);
+    CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    builder = tar_shindex_open_wait(name, fd, 1000);
+    CU_ASSERT_PTR_NOT_NULL(builder);
+    if (builder != NULL) CU_ASSERT_PTR_NOT_NULL(tar_index_lookup(&builder->index, "fichier1"));
+    tar_shindex_detach(builder);
+    CU_ASSERT_EQUAL(tar_shindex_unlink(name), 0);
+
+    // A published header whose offsets point outside the segment is rejected
+    int bogus = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    CU_ASSERT_NOT_EQUAL(bogus, -1);
+    header.sequence = 2;
+    header.total_size = 4096;
+    header.count = 13;
+    header.entries_offset = (uint64_t)1 << 40;
+    header.nslots = 16;
+    header.slots_offset = 512;
+    CU_ASSERT_EQUAL(ftruncate(bogus, 4096), 0);
+    CU_ASSERT_EQUAL(pwrite(bogus, &header, sizeof(header), 0), sizeof(header));
+    CU_ASSERT_PTR_NULL(tar_shindex_attach_fd(bogus, -1));
+    CU_ASSERT_EQUAL(errno, EINVAL);
+    header.entries_offset = 128;
+    header.count = (uint64_t)1 << 60; // the entries would wrap around
+    CU_ASSERT_EQUAL(pwrite(bogus, &header, sizeof(header), 0), sizeof(header));
+    CU_ASSERT_PTR_NULL(tar_shindex_attach_fd(bogus, -1));
+    CU_ASSERT_EQUAL(errno, EINVAL);
+    header.count = 0;
+    header.nslots = 3; // lookups mask with nslots - 1
+    CU_ASSERT_EQUAL(pwrite(bogus, &header, sizeof(header), 0), sizeof(header));
+    CU_ASSERT_PTR_NULL(tar_shindex_attach_fd(bogus, -1));
+    CU_ASSERT_EQUAL(errno, EINVAL);
+    header.nslots = 16;
+    CU_ASSERT_EQUAL(pwrite(bogus, &header, sizeof(header), 0), sizeof(header));
+    tar_shindex_t *empty_view = tar_shindex_attach_fd(bogus, -1);
+    CU_ASSERT_PTR_NOT_NULL(empty_view);
+    tar_shindex_detach(empty_view);
+
+    // Slots are checked too: lookups must stay inside the entries and end on an empty slot
+    uint32_t slots[16];
+    header.count = 1;
+    header.slots_offset = 2048;
+    CU_ASSERT_EQUAL(pwrite(bogus, &header, sizeof(header), 0), sizeof(header));
+    memset(slots, 0, sizeof(slots));
+    slots[3] = 7;
+    CU_ASSERT_EQUAL(pwrite(bogus, slots, sizeof(slots), 2048), sizeof(slots));
+    CU_ASSERT_PTR_NULL(tar_shindex_attach_fd(bogus, -1));
+    CU_ASSERT_EQUAL(errno, EINVAL);
+    for (int i = 0; i < 16; ++i) slots[i] = 1;
+    CU_ASSERT_EQUAL(pwrite(bogus, slots, sizeof(slots), 2048), sizeof(slots));
+    CU_ASSERT_PTR_NULL(tar_shindex_attach_fd(bogus, -1));
+    CU_ASSERT_EQUAL(errno, EINVAL);
+    header.count = 8;
+    header.nslots = 8; // no room for an empty slot
+    CU_ASSERT_EQUAL(pwrite(bogus, &header, sizeof(header), 0), sizeof(header));
+    CU_ASSERT_PTR_NULL(tar_shindex_attach_fd(bogus, -1));
+    CU_ASSERT_EQUAL(errno, EINVAL);
+    header.count = 1;
+    header.nslots = 16;
+    CU_ASSERT_EQUAL(pwrite(bogus, &header, sizeof(header), 0), sizeof(header));
+    memset(slots, 0, sizeof(slots));
+    slots[3] = 1;
+    CU_ASSERT_EQUAL(pwrite(bogus, slots, sizeof(slots), 2048), sizeof(slots));
+    empty_view = tar_shindex_attach_fd(bogus, -1);
+    CU_ASSERT_PTR_NOT_NULL(empty_view);
+    tar_shindex_detach(empty_view);
+    close(bogus);
+    CU_ASSERT_EQUAL(tar_shindex_unlink(name), 0);
+
+    int shm_fd = tar_shindex_create_fd(fd);
+    CU_ASSERT_NOT_EQUAL(shm_fd, -1);
+    tar_shindex_t *view = tar_shindex_attach_fd(shm_fd, fd);
+    CU_ASSERT_PTR_NOT_NULL(view);
+    const tar_entry_t *dir = tar_index_resolve(&view->index, "dir1/link_to_dir4");
+    CU_ASSERT_PTR_NOT_NULL(dir);
+    CU_ASSERT_EQUAL(tar_index_children(&view->index, dir, NULL, 0), 2);
+    tar_shindex_detach(view);
+    int empty = open("./tars/empty.tar", O_RDONLY);
+    CU_ASSERT_PTR_NULL(tar_shindex_attach_fd(shm_fd, empty));
+    CU_ASSERT_EQUAL(errno, ESTALE);
+    close(empty);
+    close(shm_fd);
+}
+
+void test_read_file_v(void){
+    uint8_t expected[33712];
+    int ref = open("./tars/achive1/dir2/dir3/dir4/file5", O_RDONLY);
+    CU_ASSERT_EQUAL(read(ref, expected, sizeof(expected)), sizeof(expected));
+    close(ref);
+
+    // Out of order, overlapping, close and far apart, past the end
+    struct tar_range ranges[6] = {{33700, 100}, {0, 5}, {2, 10}, {20, 30}, {40000, 4}, {16000, 1000}};
+    uint8_t buffers[6][1000];
+    struct iovec iovecs[6];
+    ssize_t remaining[6];
+    for (int i = 0; i < 6; ++i) iovecs[i].iov_base = buffers[i];
+    CU_ASSERT_EQUAL(read_file_v(fd, "link_to_link_to_file_5", ranges, 6, iovecs, remaining), 12 + 5 + 10 + 30 + 1000);
+    CU_ASSERT_EQUAL(iovecs[0].iov_len, 12);
+    CU_ASSERT_EQUAL(remaining[0], 0);
+    CU_ASSERT_EQUAL(memcmp(buffers[0], expected + 33700, 12), 0);
+    CU_ASSERT_EQUAL(remaining[4], -2);
+    CU_ASSERT_EQUAL(iovecs[4].iov_len, 0);
+    for (int i = 1; i < 6; ++i) {
+        if (i == 4) continue;
+        CU_ASSERT_EQUAL(iovecs[i].iov_len, ranges[i].len);
+        CU_ASSERT_EQUAL(remaining[i], (ssize_t)(33712 - ranges[i].offset - ranges[i].len));
+        CU_ASSERT_EQUAL(memcmp(buffers[i], expected + ranges[i].offset, ranges[i].len), 0);
+    }
+    // Offsets beyond INT64_MAX are past the end too, they must not wrap before the entry
+    struct tar_range huge[2] = {{SIZE_MAX, 10}, {(size_t)1 << 63, 4}};
+    CU_ASSERT_EQUAL(read_file_v(fd, "link_to_link_to_file_5", huge, 2, iovecs, remaining), 0);
+    CU_ASSERT_EQUAL(remaining[0], -2);
+    CU_ASSERT_EQUAL(remaining[1], -2);
+    CU_ASSERT_EQUAL(iovecs[0].iov_len, 0);
+    CU_ASSERT_EQUAL(iovecs[1].iov_len, 0);
+    CU_ASSERT_EQUAL(read_file_v(fd, "dir1/", ranges, 6, iovecs, remaining), -1);
+    CU_ASSERT_EQUAL(read_file_v(fd, "fichier2", ranges, 0, iovecs, remaining), 0);
+}
+
+static void async_done(tar_async_op_t *op, void *arg) {
+    __atomic_store_n((tar_async_op_t **)arg, op, __ATOMIC_RELEASE);
+}
+
+static tar_async_op_t *wait_reap(tar_async_t *pool) {
+    tar_async_op_t *op;
+    struct pollfd pfd = {tar_async_eventfd(pool), POLLIN, 0};
+    while ((op = tar_async_reap(pool)) == NULL) poll(&pfd, 1, 1000);
+    return op;
+}
+
+/* Holds the only pool thread in a completion callback until the test opens it */
+struct async_gate
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int entered;
+    int open;
+};
+
+static void async_block(tar_async_op_t *op, void *arg) {
+    struct async_gate *gate = arg;
+    pthread_mutex_lock(&gate->lock);
+    gate->entered = 1;
+    pthread_cond_broadcast(&gate->changed);
+    while (!gate->open) pthread_cond_wait(&gate->changed, &gate->lock);
+    pthread_mutex_unlock(&gate->lock);
+}
+
+void test_async(void){
+    tar_async_t *pool = tar_async_new(1, 2);
+    CU_ASSERT_PTR_NOT_NULL(pool);
+
+    // Keep the only thread busy so that the next operations stay queued
+    struct async_gate gate = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0};
+    tar_async_op_t *blocker = tar_async_stat(pool, fd, "fichier2", async_block, &gate);
+    CU_ASSERT_PTR_NOT_NULL(blocker);
+    pthread_mutex_lock(&gate.lock);
+    while (!gate.entered) pthread_cond_wait(&gate.changed, &gate.lock);
+    pthread_mutex_unlock(&gate.lock);
+
+    uint8_t buffer[100];
+    tar_async_op_t *read_op = tar_async_read(pool, fd, "dir2/dir3/dir4/file5", 33612, buffer, sizeof(buffer), NULL, NULL);
+    tar_async_op_t *stat_op = tar_async_stat(pool, fd, "fichier1", NULL, NULL);
+    CU_ASSERT_PTR_NOT_NULL(read_op);
+    CU_ASSERT_PTR_NOT_NULL(stat_op);
+    // Backpressure: two operations are queued, the pool is full
+    CU_ASSERT_PTR_NULL(tar_async_stat(pool, fd, "fichier2", NULL, NULL));
+    CU_ASSERT_EQUAL(errno, EAGAIN);
+    CU_ASSERT_EQUAL(tar_async_cancel(pool, stat_op), 0);
+    // The cancelled operation completed at once and freed its place
+    CU_ASSERT_PTR_EQUAL(tar_async_reap(pool), stat_op);
+    CU_ASSERT_EQUAL(stat_op->state, TAR_ASYNC_CANCELLED);
+    CU_ASSERT_EQUAL(stat_op->result, -1);
+    tar_async_release(stat_op);
+    tar_async_op_t *retry_op = tar_async_stat(pool, fd, "fichier1", NULL, NULL);
+    CU_ASSERT_PTR_NOT_NULL(retry_op);
+    // The blocker already ran, it cannot be cancelled anymore
+    CU_ASSERT_EQUAL(tar_async_cancel(pool, blocker), -1);
+    CU_ASSERT_EQUAL(errno, EBUSY);
+
+    pthread_mutex_lock(&gate.lock);
+    gate.open = 1;
+    pthread_cond_broadcast(&gate.changed);
+    pthread_mutex_unlock(&gate.lock);
+    tar_async_op_t *first = wait_reap(pool);
+    tar_async_op_t *second = wait_reap(pool);
+    CU_ASSERT_PTR_EQUAL(first, read_op);
+    CU_ASSERT_EQUAL(read_op->state, TAR_ASYNC_DONE);
+    CU_ASSERT_EQUAL(read_op->result, 0);
+    CU_ASSERT_EQUAL(read_op->len, 100);
+    CU_ASSERT_PTR_EQUAL(second, retry_op);
+    CU_ASSERT_EQUAL(retry_op->state, TAR_ASYNC_DONE);
+    CU_ASSERT_NOT_EQUAL(retry_op->result, 0);
+    CU_ASSERT_EQUAL(TAR_INT(retry_op->header.size), 603);
+    // The thread left the callback before taking the next operation
+    CU_ASSERT_EQUAL(blocker->state, TAR_ASYNC_DONE);
+    tar_async_release(blocker);
+    tar_async_release(read_op);
+    tar_async_release(retry_op);
+    CU_ASSERT_PTR_NULL(tar_async_reap(pool));
+
+    char storage[4][MAX_PATH_SIZE + 1];
+    char *entries[4] = {storage[0], storage[1], storage[2], storage[3]};
+    tar_async_op_t *done = NULL;
+    CU_ASSERT_PTR_NOT_NULL(tar_async_list(pool, fd, "dir1/", entries, 4, async_done, &done));
+    while (__atomic_load_n(&done, __ATOMIC_ACQUIRE) == NULL) usleep(100);
+    CU_ASSERT_EQUAL(done->kind, TAR_ASYNC_LIST);
+    CU_ASSERT_NOT_EQUAL(done->result, 0);
+    CU_ASSERT_EQUAL(done->no_entries, 2);
+    tar_async_release(done);
+    tar_async_free(pool);
+}
+
+struct stream_result {
+    int headers, ended;
+    const char *skip;             /* name of a member to skip, or NULL */
+    size_t data;
+    char start_of_file5[6];
+};
+
+static int record_event(const tar_stream_event_t *event, void *arg) {
+    struct stream_result *result = arg;
+    if (event->type == TAR_STREAM_END) result->ended = 1;
+    if (event->type == TAR_STREAM_HEADER) result->headers++;
+    int file5 = event->header != NULL && strcmp(event->header->name, "dir2/dir3/dir4/file5") == 0;
+    if (event->type == TAR_STREAM_HEADER && result->skip != NULL && strcmp(event->header->name, result->skip) == 0) {
+        return TAR_STREAM_SKIP;
+    }
+    if (event->type == TAR_STREAM_DATA) {
+        result->data += event->len;
+        if (file5 && event->offset < 5) {
+            size_t n = 5 - event->offset < event->len ? 5 - event->offset : event->len;
+            memcpy(result->start_of_file5 + event->offset, event->data, n);
+        }
+    }
+    return TAR_STREAM_CONTINUE;
+}
+
+/* Bytes this process got from read system calls so far, from /proc/self/io */
+static long long bytes_read_by_process(void) {
+    FILE *io = fopen("/proc/self/io", "r");
+    long long rchar = -1;
+    if (io == NULL) return -1;
+    if (fscanf(io, "rchar: %lld", &rchar) != 1) rchar = -1;
+    fclose(io);
+    return rchar;
+}
+
+void test_stream(void){
+    static uint8_t archive[51200];
+    CU_ASSERT_EQUAL(pread(fd, archive, sizeof(archive), 0), sizeof(archive));
+
+    // Pushed in pieces that do not line up with the blocks
+    struct stream_result result;
+    memset(&result, 0, sizeof(result));
+    result.skip = "dir2/dir3/dir4/file5";
+    tar_stream_t stream;
+    tar_stream_init(&stream, record_event, &result);
+    int status = TAR_STREAM_MORE;
+    for (size_t done = 0; done < sizeof(archive) && status == TAR_STREAM_MORE; done += 100) {
+        status = tar_stream_feed(&stream, archive + done, sizeof(archive) - done < 100 ? sizeof(archive) - done : 100);
+    }
+    CU_ASSERT_EQUAL(status, TAR_STREAM_DONE);
+    CU_ASSERT_EQUAL(tar_stream_finish(&stream), 13);
+    CU_ASSERT_EQUAL(result.headers, 13);
+    CU_ASSERT_EQUAL(result.data, 605);
+    CU_ASSERT(result.ended);
+
+    // Pulled from a pipe
+    int pipe_fds[2];
+    CU_ASSERT_EQUAL(pipe(pipe_fds), 0);
+    pid_t child = fork();
+    if (child == 0) {
+        close(pipe_fds[0]);
+        _exit(write(pipe_fds[1], archive, sizeof(archive)) == sizeof(archive) ? 0 : 1);
+    }
+    close(pipe_fds[1]);
+    memset(&result, 0, sizeof(result));
+    CU_ASSERT_EQUAL(tar_stream_fd(pipe_fds[0], record_event, &result), 13);
+    CU_ASSERT_EQUAL(result.data, 605 + 33712);
+    CU_ASSERT_STRING_EQUAL(result.start_of_file5, "Lorem");
+    close(pipe_fds[0]);
+    waitpid(child, NULL, 0);
+
+    // Skipped members of a regular file are jumped over
+    int file_fd = open("./tars/archive.tar", O_RDONLY);
+    memset(&result, 0, sizeof(result));
+    result.skip = "dir2/dir3/dir4/file5";
+    CU_ASSERT_EQUAL(tar_stream_fd(file_fd, record_event, &result), 13);
+    CU_ASSERT_EQUAL(result.data, 605);
+    close(file_fd);
+
+    // A member larger than the buffer is really jumped over, not read and dropped
+    char big_path[] = "/tmp/tar_tests_stream_XXXXXX";
+    uint8_t *content = NULL;
+    size_t big_size = 4 * TAR_STREAM_BUFFER + 100;
+    int big_fd = make_big_archive(big_path, big_size, &content);
+    CU_ASSERT_NOT_EQUAL(big_fd, -1);
+    unlink(big_path);
+    free(content);
+    memset(&result, 0, sizeof(result));
+    result.skip = "big";
+    long long before = bytes_read_by_process();
+    CU_ASSERT_EQUAL(tar_stream_fd(big_fd, record_event, &result), 2);
+    long long read_bytes = bytes_read_by_process() - before;
+    CU_ASSERT_EQUAL(result.data, 10);
+    CU_ASSERT(read_bytes > 0 && read_bytes <= 2 * TAR_STREAM_BUFFER);
+    close(big_fd);
+
+    tar_stream_init(&stream, record_event, &result);
+    CU_ASSERT_EQUAL(tar_stream_feed(&stream, archive, 10000), TAR_STREAM_MORE);
+    CU_ASSERT_EQUAL(tar_stream_finish(&stream), TAR_STREAM_TRUNCATED);
+
+    archive[0] ^= 1; // corrupt the name of the first member
+    tar_stream_init(&stream, record_event, &result);
+    CU_ASSERT_EQUAL(tar_stream_feed(&stream, archive, 700), -3);
+    CU_ASSERT_EQUAL(tar_stream_feed(&stream, archive, 700), -3);
+    CU_ASSERT_EQUAL(tar_stream_finish(&stream), -3);
+}
+
+void test_scan(void){
+    struct stream_result result;
+    memset(&result, 0, sizeof(result));
+    tar_scan_stats_t stats;
+    CU_ASSERT_EQUAL(tar_scan(fd, record_event, &result, &stats), 13);
+    CU_ASSERT_EQUAL(result.data, 605 + 33712);
+    CU_ASSERT_STRING_EQUAL(result.start_of_file5, "Lorem");
+    CU_ASSERT(result.ended);
+    CU_ASSERT_EQUAL(stats.bytes_read, 51200);
+    CU_ASSERT_EQUAL(tar_scan_check(fd), check_archive(fd));
+
+    int empty = open("./tars/empty.tar", O_RDONLY);
+    CU_ASSERT_EQUAL(tar_scan_check(empty), 0);
+    close(empty);
+
+    // Most of a member spanning several blocks is jumped over
+    char big_path[] = "/tmp/tar_tests_scan_XXXXXX";
+    uint8_t *content = NULL;
+    int big_fd = make_big_archive(big_path, 3 * TAR_SCAN_BLOCK, &content);
+    CU_ASSERT_NOT_EQUAL(big_fd, -1);
+    unlink(big_path);
+    free(content);
+    struct stat st;
+    CU_ASSERT_EQUAL(fstat(big_fd, &st), 0);
+    memset(&result, 0, sizeof(result));
+    result.skip = "big";
+    CU_ASSERT_EQUAL(tar_scan(big_fd, record_event, &result, &stats), 2);
+    CU_ASSERT_EQUAL(result.data, 10);
+    CU_ASSERT(stats.bytes_skipped >= TAR_SCAN_BLOCK);
+    // The first block and the one read ahead before the jump was known
+    CU_ASSERT(stats.bytes_read >= 2 * TAR_SCAN_BLOCK && stats.bytes_read < (uint64_t)st.st_size);
+    CU_ASSERT(stats.bytes_read + stats.bytes_skipped >= (uint64_t)st.st_size);
+
+    // Without a descriptor left to reopen the archive with O_DIRECT, it is read buffered
+    pid_t child = fork();
+    if (child == 0) {
+        struct rlimit limit = {64, 64};
+        if (setrlimit(RLIMIT_NOFILE, &limit) == -1) _exit(2);
+        while (dup(big_fd) != -1) {}
+        memset(&result, 0, sizeof(result));
+        result.skip = "big";
+        long members = tar_scan(big_fd, record_event, &result, &stats);
+        _exit(members == 2 && result.data == 10 && stats.direct == 0 && stats.bytes_skipped > 0 ? 0 : 1);
+    }
+    int status = -1;
+    waitpid(child, &status, 0);
+    CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    close(big_fd);
+}
+
+/* Copy of archive.tar with a member of size -1024 (base-256) appended, opened on a temporary file */
+static int open_negative_size_archive(char *path) {
+    static uint8_t archive[51200];
+    if (pread(fd, archive, sizeof(archive), 0) != sizeof(archive)) return -1;
+    tar_index_t *index = tar_index_build(fd);
+    if (index == NULL) return -1;
+    const tar_entry_t *last = &index->entries[index->count - 1];
+    off_t end = last->data_offset + ((last->size + BLOCKSIZE - 1) / BLOCKSIZE) * BLOCKSIZE;
+    tar_index_free(index);
+
+    tar_header_t *evil = (tar_header_t *)(archive + end);
+    memcpy(evil, archive, BLOCKSIZE); // the first header, a valid directory
+    strcpy(evil->name, "evil");
+    evil->typeflag = REGTYPE;
+    memset(evil->size, 0xff, sizeof(evil->size));
+    evil->size[10] = (char)0xfc;
+    evil->size[11] = 0;
+    snprintf(evil->chksum, sizeof(evil->chksum), "%06o", calculate_tar_checksum(evil));
+    evil->chksum[7] = ' ';
+
+    int evil_fd = mkstemp(path);
+    if (evil_fd == -1 || write(evil_fd, archive, sizeof(archive)) != sizeof(archive)) return -1;
+    return evil_fd;
+}
+
+void test_negative_size(void){
+    char path[] = "/tmp/tar_negative_XXXXXX";
+    int evil_fd = open_negative_size_archive(path);
+    CU_ASSERT_NOT_EQUAL(evil_fd, -1);
+    CU_ASSERT_EQUAL(tar_decode_number("\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xfc\x00", 12), -1024);
+
+    // Every scan stops at the malformed header instead of seeking backwards forever
+    CU_ASSERT_EQUAL(check_archive(evil_fd), -4);
+    CU_ASSERT_NOT_EQUAL(exists(evil_fd, "fichier1"), 0);
+    CU_ASSERT_EQUAL(exists(evil_fd, "evil"), 0);
+    CU_ASSERT_EQUAL(exists(evil_fd, "missing"), 0);
+    char storage[4][MAX_PATH_SIZE + 1];
+    char *entries[4] = {storage[0], storage[1], storage[2], storage[3]};
+    size_t no_entries = 4;
+    list(evil_fd, "dir2/", entries, &no_entries);
+    uint8_t buffer[16];
+    size_t len = sizeof(buffer);
+    CU_ASSERT_EQUAL(read_file(evil_fd, "evil", 0, buffer, &len), -1);
+    CU_ASSERT_PTR_NULL(tar_index_build(evil_fd));
+    CU_ASSERT_PTR_NULL(tar_fcindex_build(evil_fd));
+
+    static uint8_t archive[51200];
+    CU_ASSERT_EQUAL(pread(evil_fd, archive, sizeof(archive), 0), sizeof(archive));
+    tar_stream_t stream;
+    struct stream_result result;
+    memset(&result, 0, sizeof(result));
+    tar_stream_init(&stream, record_event, &result);
+    CU_ASSERT_EQUAL(tar_stream_feed(&stream, archive, sizeof(archive)), -4);
+    CU_ASSERT_EQUAL(result.headers, 13);
+
+    close(evil_fd);
+    unlink(path);
+}
+
+/* Starts ./tar_served on one end of a socketpair, returns the other end */
+static int spawn_served(pid_t *child) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) return -1;
+    *child = fork();
+    if (*child == 0) {
+        dup2(sv[1], STDIN_FILENO);
+        close(sv[0]);
+        close(sv[1]);
+        // Without a cache, every READ is sent with sendfile
+        execl("./tar_served", "tar_served", "-c", "0", "-i", "./tars/archive.tar", (char *)NULL);
+        _exit(127);
+    }
+    close(sv[1]);
+    return sv[0];
+}
+
+void test_served(void){
+    pid_t child;
+    int sock = spawn_served(&child);
+    CU_ASSERT_NOT_EQUAL(sock, -1);
+    if (sock == -1) return;
+
+    // Every request is sent before the client shuts down its side, they must all be answered
+    const char *requests = "OPEN 0 fichier1\nSTAT 0 dir2/file3\nREAD 0 0 100000 dir2/dir3/dir4/file5\n"
+                           "READ 0 18446744073709551615 10 fichier1\nREAD 0 9223372036854775808 10 fichier1\nBOGUS 0 x\n";
+    CU_ASSERT_EQUAL(write(sock, requests, strlen(requests)), (ssize_t)strlen(requests));
+    shutdown(sock, SHUT_WR);
+
+    static char reply[40000];
+    size_t got = 0;
+    int passed_fd = -1;
+    for (;;) {
+        struct iovec iov = {reply + got, sizeof(reply) - got};
+        union {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(sizeof(int))];
+        } control;
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        ssize_t n = recvmsg(sock, &msg, 0);
+        if (n <= 0) break;
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg != NULL && cmsg->cmsg_type == SCM_RIGHTS) memcpy(&passed_fd, CMSG_DATA(cmsg), sizeof(int));
+        got += (size_t)n;
+    }
+    close(sock);
+    int status;
+    waitpid(child, &status, 0);
+    CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // OPEN passes the archive descriptor along with the offset of the data
+    off_t data_offset, size;
+    CU_ASSERT_EQUAL(tar_locate_file(fd, "fichier1", &data_offset, &size), 0);
+    char line[64];
+    int n = snprintf(line, sizeof(line), "OK %lld %lld\n", (long long)data_offset, (long long)size);
+    CU_ASSERT_NSTRING_EQUAL(reply, line, n);
+    CU_ASSERT_NOT_EQUAL(passed_fd, -1);
+    char expected[603], actual[603];
+    size_t len = sizeof(expected);
+    CU_ASSERT_EQUAL(read_file(fd, "fichier1", 0, (uint8_t *)expected, &len), 0);
+    CU_ASSERT_EQUAL(pread(passed_fd, actual, sizeof(actual), data_offset), sizeof(actual));
+    CU_ASSERT_EQUAL(memcmp(expected, actual, sizeof(expected)), 0);
+    close(passed_fd);
+
+    const char *p = reply + n;
+    CU_ASSERT_NSTRING_EQUAL(p, "OK 1 1 ", 7);
+    p = memchr(p, '\n', got - (size_t)(p - reply)) + 1;
+    CU_ASSERT_NSTRING_EQUAL(p, "OK 33712 0\n", 11);
+    p += 11;
+    static uint8_t file5[33712];
+    len = sizeof(file5);
+    CU_ASSERT_EQUAL(read_file(fd, "dir2/dir3/dir4/file5", 0, file5, &len), 0);
+    CU_ASSERT_EQUAL(memcmp(p, file5, sizeof(file5)), 0);
+    p += sizeof(file5);
+    // Offsets past the member are refused, even those that do not fit in a signed offset
+    CU_ASSERT_EQUAL(reply + got - p, 33);
+    CU_ASSERT_NSTRING_EQUAL(p, "ERR ERANGE\nERR ERANGE\nERR ENOSYS\n", 33);
+}
+
+/* Runs ./tar_query on a batch of commands, returns the length of its output and sets its exit status */
+static size_t run_query(const char *archive_path, const char *commands, char *out, size_t size, int *status) {
+    char path[] = "/tmp/tar_query_XXXXXX";
+    int commands_fd = mkstemp(path);
+    if (commands_fd == -1) return 0;
+    if (write(commands_fd, commands, strlen(commands)) != (ssize_t)strlen(commands)) size = 0;
+    close(commands_fd);
+    char command[256];
+    snprintf(command, sizeof(command), "./tar_query -f %s %s 2>/dev/null", path, archive_path);
+    FILE *query = popen(command, "r");
+    size_t got = query != NULL ? fread(out, 1, size, query) : 0;
+    *status = query != NULL ? pclose(query) : -1;
+    unlink(path);
+    return got;
+}
+
+void test_query(void){
+    static char out[40000];
+    int status;
+    const char *commands = "exists fichier1\nexists nope\ntype dir1/\ntype dir1/link_to_dir4\ntype nope\n"
+                           "ls dir2/\nls dir1/link_to_dir4\nls fichier1\ncat fichier2 0 10\n\ncheck\nfoo\n"
+                           "cat nope 0 1\ncat fichier2 5 1\ncat fichier1 18446744073709551615 10\n"
+                           "cat fichier1 9223372036854775808 4\ncat fichier1 abc 5\ncat fichier1 -1 5\n"
+                           "cat fichier1 0 18446744073709551616\n";
+    const char *expected = "1\n0\ndir\nsymlink\nnone\n"
+                           "2\ndir2/file3\ndir2/dir3/\n2\ndir2/dir3/dir4/link_to_file5\ndir2/dir3/dir4/file5\n-1\n1 0\n2\n?\n13\n?\n"
+                           "-1 -1\n-2 -1\n-2 -1\n-2 -1\n?\n?\n?\n";
+    size_t got = run_query("./tars/archive.tar", commands, out, sizeof(out), &status);
+    CU_ASSERT_EQUAL(status, 0);
+    CU_ASSERT_EQUAL(got, strlen(expected));
+    CU_ASSERT_NSTRING_EQUAL(out, expected, strlen(expected));
+
+    // A large cat is streamed in chunks
+    got = run_query("./tars/archive.tar", "cat link_to_link_to_file_5 100 100000\n", out, sizeof(out), &status);
+    CU_ASSERT_EQUAL(status, 0);
+    CU_ASSERT_NSTRING_EQUAL(out, "33612 0\n", 8);
+    CU_ASSERT_EQUAL(got, 8 + 33612 + 1);
+    static uint8_t file5[33712];
+    size_t len = sizeof(file5);
+    CU_ASSERT_EQUAL(read_file(fd, "dir2/dir3/dir4/file5", 0, file5, &len), 0);
+    CU_ASSERT_EQUAL(memcmp(out + 8, file5 + 100, 33612), 0);
+
+    // In a truncated archive, only the bytes that are really there are answered, never padding
+    off_t data_offset, size;
+    CU_ASSERT_EQUAL(tar_locate_file(fd, "dir2/dir3/dir4/file5", &data_offset, &size), 0);
+    char path[] = "/tmp/tar_truncated_XXXXXX";
+    int truncated_fd = mkstemp(path);
+    static uint8_t archive[51200];
+    CU_ASSERT_EQUAL(pread(fd, archive, sizeof(archive), 0), sizeof(archive));
+    CU_ASSERT_EQUAL(write(truncated_fd, archive, data_offset + 1000), data_offset + 1000);
+    close(truncated_fd);
+    got = run_query(path, "cat dir2/dir3/dir4/file5 0 5000\ncat dir2/dir3/dir4/file5 0 1000\nexists fichier1\n",
+                    out, sizeof(out), &status);
+    CU_ASSERT_EQUAL(status, 0);
+    CU_ASSERT_EQUAL(got, 6 + 11 + 1000 + 1 + 2);
+    CU_ASSERT_NSTRING_EQUAL(out, "-3 -1\n1000 32712\n", 17);
+    CU_ASSERT_EQUAL(memcmp(out + 17, file5, 1000), 0);
+    CU_ASSERT_NSTRING_EQUAL(out + 17 + 1000, "\n0\n", 3);
+    unlink(path);
+}
+
 void print_archive(void){
     tar_header_t header;
     go_back_start(fd);
@@ -254,7 +1466,10 @@ int main(int argc, char **argv) {
     }
 
     // add the tests to the suite
-    if ((NULL == CU_add_test(pSuite1, "test of check archive function", test_check_archive))){
+    if ((NULL == CU_add_test(pSuite1, "test of check archive function", test_check_archive))||
+        (NULL == CU_add_test(pSuite1, "test of tar_decode_number function", test_decode_number))||
+        (NULL == CU_add_test(pSuite1, "test of headers with a negative size", test_negative_size))||
+        (NULL == CU_add_test(pSuite1, "test of the Bloom filter", test_bloom))){
         CU_cleanup_registry();
         return CU_get_error();
     }
@@ -271,7 +1486,9 @@ int main(int argc, char **argv) {
     if ((NULL == CU_add_test(pSuite2, "test of exists function", test_exists))||
         (NULL == CU_add_test(pSuite2, "test of is_dir function", test_is_dir))||
         (NULL == CU_add_test(pSuite2, "test of is_file function", test_is_file))||
-        (NULL == CU_add_test(pSuite2, "test of is_symlink function", test_is_symlink))){
+        (NULL == CU_add_test(pSuite2, "test of is_symlink function", test_is_symlink))||
+        (NULL == CU_add_test(pSuite2, "test of the path index", test_index))||
+        (NULL == CU_add_test(pSuite2, "test of the front-coded path index", test_fcindex))){
         CU_cleanup_registry();
         return CU_get_error();
     }
@@ -301,7 +1518,21 @@ int main(int argc, char **argv) {
     }
 
     // add the tests to the suite
-    if ((NULL == CU_add_test(pSuite4, "test of read file function", test_read_file))){
+    if ((NULL == CU_add_test(pSuite4, "test of read file function", test_read_file))||
+        (NULL == CU_add_test(pSuite4, "test of read file content", test_read_file_content))||
+        (NULL == CU_add_test(pSuite4, "test of read file through the block cache", test_read_file_cached))||
+        (NULL == CU_add_test(pSuite4, "test of tar_send_entry function", test_send_entry))||
+        (NULL == CU_add_test(pSuite4, "test of read_file_v function", test_read_file_v))||
+        (NULL == CU_add_test(pSuite4, "test of the asynchronous operations", test_async))||
+        (NULL == CU_add_test(pSuite4, "test of the streaming parser", test_stream))||
+        (NULL == CU_add_test(pSuite4, "test of the direct scanner", test_scan))||
+        (NULL == CU_add_test(pSuite4, "test of the tar_served protocol", test_served))||
+        (NULL == CU_add_test(pSuite4, "test of the tar_query commands", test_query))||
+        (NULL == CU_add_test(pSuite4, "test of tar_search function", test_search))||
+        (NULL == CU_add_test(pSuite4, "test of tar_diff function", test_diff))||
+        (NULL == CU_add_test(pSuite4, "test of tar_digest_all function", test_digest))||
+        (NULL == CU_add_test(pSuite4, "test of the overlay of two archives", test_overlay))||
+        (NULL == CU_add_test(pSuite4, "test of the index shared between processes", test_shindex))){
         CU_cleanup_registry();
         return CU_get_error();
     }